@@ -0,0 +1,254 @@
+/*
+ * anneal.c
+ * Copyright (C) Jacob Gajek 2010 <jgajek@gmail.com>
+ *
+ * Alkindus is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alkindus is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "solve.h"
+
+
+#define ANNEALBLOCK     1000    // Proposals between temperature updates
+#define ANNEALSAMPLES   200     // Swaps sampled to pick a start temperature
+#define ANNEALFINAL     1e-3    // Final/initial temperature
+
+
+static void   annealInit  (char *key, rngState *rng);
+static double annealStart (solveContext *ctx, char *key, double fit,
+                           int *letters, int numLetters, rngState *rng);
+static double annealTemp  (double start, int step);
+static int    annealPartner (int x, rngState *rng);
+
+
+/**
+ * annealSolve: Solve cryptogram by simulated annealing. Each proposal
+ *              swaps two key entries and is scored with
+ *              cryptoEvalSwapBounded.
+ *              The trial publishes its best key after every block of
+ *              ANNEALBLOCK proposals; the block number is reported as
+ *              the generation.
+ *
+ * @trial: Number of current trial
+ * @udata: Solve the trial belongs to
+ *
+ * @Returns: Nothing
+ **/
+void
+annealSolve (gpointer trial,
+             gpointer udata)
+{
+  solveContext *ctx = udata;
+  char          key[NUMSYMBOLS+1];
+  char          trialKey[NUMSYMBOLS+1];
+  int           letters[NUMSYMBOLS];
+  int           numLetters = 0;
+  rngState      rng;
+  int           trialNum = GPOINTER_TO_INT(trial);
+
+  if (g_atomic_int_get(&ctx->cancel) == TRUE) {
+    return;
+  }
+
+  rngInit(&rng, ctx->seed, trialNum);
+
+  /* Every proposal swaps the entry of a letter that occurs in the text */
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    if (ctx->freq[i] > 0) {
+      letters[numLetters++] = i;
+    }
+  }
+
+  annealInit(key, &rng);
+
+  double fit      = cryptoEval(ctx, key);
+  double trialFit = fit;
+  double start    = startTemp;
+
+  strcpy(trialKey, key);
+
+  if (start <= 0.0) {
+    start = annealStart(ctx, key, fit, letters, numLetters, &rng);
+  }
+
+  int numBlocks = (annealSteps + ANNEALBLOCK-1) / ANNEALBLOCK;
+
+  for (int b = 0; b < numBlocks && numLetters > 0; b++) {
+    double   temp = annealTemp(start, b * ANNEALBLOCK);
+    gboolean improved = FALSE;
+
+    for (int s = 0; s < ANNEALBLOCK; s++) {
+      int x = letters[rngInt(&rng, numLetters)];
+      int y = annealPartner(x, &rng);
+
+      /*
+       * A key that loses d is accepted with probability exp(-d / temp),
+       * that is when d is under -temp * log(u) for a uniform u. Drawing u
+       * first gives the lowest acceptable score, so rescoring can stop
+       * early for proposals that will be rejected.
+       */
+      double least = fit;
+
+      if (temp > 0.0) {
+        least += temp * log(rngDouble(&rng));
+      }
+
+      double swapFit = cryptoEvalSwapBounded(ctx, key, fit, x, y, least);
+
+      if (swapFit >= least) {
+        char tmp = key[x];
+        key[x] = key[y];
+        key[y] = tmp;
+        fit = swapFit;
+
+        if (fit > trialFit) {
+          strcpy(trialKey, key);
+          trialFit = fit;
+          improved = TRUE;
+        }
+      }
+    }
+
+    g_atomic_int_add(&ctx->evalCount, ANNEALBLOCK);
+
+    if (improved == TRUE) {
+      cryptoPublish(ctx, trialKey, trialFit, trialNum, b+1);
+    }
+
+    if (g_atomic_int_get(&ctx->cancel) == TRUE) {
+      break;
+    }
+  }
+
+  if (numLetters == 0) {
+    cryptoPublish(ctx, trialKey, trialFit, trialNum, 0);
+  }
+
+}
+
+
+/**
+ * annealInit: Generate a random starting key
+ *
+ * @key: Address where to store the key
+ *
+ * @Returns: Nothing
+ **/
+static void
+annealInit (char     *key,
+            rngState *rng)
+{
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    key[i] = 'a'+i;
+  }
+  key[NUMSYMBOLS] = NUL;
+
+  for (int i = NUMSYMBOLS-1; i > 0; i--) {
+    int  j = rngInt(rng, i+1);
+    char tmp = key[i];
+
+    key[i] = key[j];
+    key[j] = tmp;
+  }
+}
+
+
+/**
+ * annealStart: Choose a start temperature at which a typical worsening
+ *              swap is accepted with probability 1/e, from the mean score
+ *              loss of random swaps of the starting key
+ *
+ * @Returns: Start temperature
+ **/
+static double
+annealStart (solveContext *ctx,
+             char         *key,
+             double        fit,
+             int          *letters,
+             int           numLetters,
+             rngState     *rng)
+{
+  double loss  = 0.0;
+  int    count = 0;
+
+  if (numLetters == 0) {
+    return 1.0;
+  }
+
+  for (int s = 0; s < ANNEALSAMPLES; s++) {
+    int x = letters[rngInt(rng, numLetters)];
+    int y = annealPartner(x, rng);
+
+    double delta = cryptoEvalSwap(ctx, key, fit, x, y) - fit;
+
+    if (delta < 0.0) {
+      loss  -= delta;
+      count += 1;
+    }
+  }
+
+  g_atomic_int_add(&ctx->evalCount, ANNEALSAMPLES);
+
+  return (count > 0) ? loss / count : 1.0;
+}
+
+
+/**
+ * annealTemp: Compute the temperature after a number of proposals
+ *
+ * @start: Start temperature
+ * @step: Number of proposals made so far
+ *
+ * @Returns: Temperature
+ **/
+static double
+annealTemp (double start,
+            int    step)
+{
+  double p = (double) step / annealSteps;
+
+  switch (annealSchedule) {
+  case SCHEDLINEAR:
+    return start * (1.0 - p);
+
+  case SCHEDLUNDY:
+    return start / (1.0 + (1.0 / ANNEALFINAL - 1.0) * p);
+
+  default:
+    return start * pow(ANNEALFINAL, p);
+  }
+}
+
+
+/**
+ * annealPartner: Choose the key entry to swap with entry @x. Any other
+ *                entry qualifies, including those of letters absent from
+ *                the text, which hold the plaintext letters not in use.
+ *
+ * @x: Key entry being swapped
+ *
+ * @Returns: Index of the other key entry
+ **/
+static int
+annealPartner (int       x,
+               rngState *rng)
+{
+  int y = rngInt(rng, NUMSYMBOLS-1);
+
+  return (y >= x) ? y+1 : y;
+}
@@ -26,23 +26,96 @@
 #include "solve.h"
 
 
-#define MAXCIPHERLEN  512
+#define SYMALIGN      64    // Alignment of the symbol-index ciphertext
+#define SYMPAD        64    // Zero bytes after it, for vector loads
+#define BOUNDSLACK    1e-6  // Margin for rounding in bounded scoring
+#define HISTCHECKKEYS 16    // Random keys compared by cryptoHistCheck
+#define HISTCHECKTOL  1e-12 // Relative error allowed by --histogram
+#define MAXWAIT       3600  // Longest single wait of cryptoWait, in seconds
 
 
-int freq[NUMSYMBOLS] = {
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+/*
+ * For each ciphertext letter, swapWin holds the sorted positions of the
+ * scoring windows it touches, so that cryptoEvalSwap can rescore only the
+ * n-grams affected by swapping two key entries. A window is identified by
+ * the position of its last character; window ngramLen-2 is the leading
+ * (n-1)-gram scored with its prior probability.
+ *
+ * histGram and histCount hold the distinct ciphertext n-grams and their
+ * multiplicities. When the list is short compared to the text (useHist),
+ * cryptoEval sums count * score over it instead of walking the whole
+ * ciphertext. That sum is exact only over quantized score tables, so
+ * with double tables it is used only when --histogram asks for it. Then
+ * histWin lists for each ciphertext letter the sorted
+ * histogram entries containing it, which cryptoEvalSwap rescores instead
+ * of text windows. Entry -1 is the leading (n-1)-gram.
+ */
+
+/*
+ * While a solve runs, the overall best key is kept in a record that is
+ * never modified once published; a better key is published by swapping
+ * in a new record with an atomic compare-and-exchange. An offer that
+ * does not beat the current record is turned away after a single atomic
+ * read, so publishing takes no lock. Replaced records stay linked from
+ * their successor and are freed when the solve ends, so a trial reading
+ * the record never sees freed memory.
+ */
+struct s_bestRecord {
+  char    key[NUMSYMBOLS+1];
+  double  fit;
+  int     trial;
+  int     gen;
+  struct s_bestRecord *prev;    // Record replaced by this one
 };
 
+typedef struct s_bestRecord bestRecord;
+
+/*
+ * In a race, every trial gets a small budget of generations. After each
+ * round the best 1/raceEta of the trials, by their best score, have their
+ * budget multiplied by raceEta and are resumed; the rest are dropped. The
+ * rounds are sized so that the last trial standing runs maxGens
+ * generations (successive halving).
+ */
+struct s_raceEntry {
+  solveContext *ctx;
+  int           trial;
+  genTrial     *state;          // NULL until the trial first runs
+};
+
+typedef struct s_raceEntry raceEntry;
+
+static void   cryptoIndexInit (solveContext *ctx);
+static void   cryptoHistInit  (solveContext *ctx);
+static double cryptoEvalHist  (solveContext *ctx, char *key);
+static gboolean cryptoHistCheck (solveContext *ctx);
+static void   cryptoProgress  (workPool *pool, GTimer *timer);
+static void   cryptoWait      (solveContext *ctx, workPool *pool);
+static void   cryptoRace      (solveContext *ctx, workPool *pool);
+static void   cryptoRaceTask  (gpointer data, gpointer udata);
+static int    cryptoRaceCompare (const void *a, const void *b);
 
-static FILE *fp;
 
-char *encText;      // Ciphertext
-char *decText;      // Plaintext
-char *solText;      // Text of correct solution (if given)
-int   textLen;      // Length of ciphertext/plaintext
+/**
+ * cryptoNew: Create the context for the solve of one cryptogram. The
+ *            per-solve parameters start out as given on the command line
+ *            and may be changed before the solve is run.
+ *
+ * @Returns: New context, to be loaded with cryptoLoad or cryptoLoadText
+ **/
+solveContext *
+cryptoNew (void)
+{
+  solveContext *ctx = g_new0(solveContext, 1);
+
+  ctx->bestFit     = -INFINITY;
+  ctx->seed        = randSeed;
+  ctx->numTrials   = numTrials;
+  ctx->timeLimit   = timeLimit;
+  ctx->targetScore = targetScore;
 
-int   numLeft;      // Number of trials left to perform
+  return ctx;
+}
 
 
 /**
@@ -54,88 +127,142 @@ int   numLeft;      // Number of trials left to perform
  * @Return: FALSE if an error occurs
  **/
 gboolean
-cryptoLoad (const char *file, const char *solution)
+cryptoLoad (solveContext *ctx,
+            const char   *file,
+            const char   *solution)
 {
-  if ((fp = fopen(file, "r")) == NULL) {
+  gchar   *text    = NULL;
+  gchar   *solText = NULL;
+  gboolean status;
+
+  if (g_file_get_contents(file, &text, NULL, NULL) == FALSE) {
     g_critical("Error opening file '%s' for reading\n", file);
     return FALSE;
   }
 
-	gsize bufsize = MAXCIPHERLEN;
-  textLen = 0;
+  /* Read in correct solution if given */
+  if (solution != NULL &&
+      g_file_get_contents(solution, &solText, NULL, NULL) == FALSE) {
+    g_critical("Error opening file '%s' for reading\n", solution);
+    g_free(text);
+    return FALSE;
+  }
 
-	encText = g_malloc(bufsize);
-	decText = g_malloc(bufsize);
+  status = cryptoLoadText(ctx, text, solText);
 
-	/* Read in ciphertext from file */
-	while (!feof(fp)) {
-		int c = getc(fp);
+  g_free(text);
+  g_free(solText);
 
-		if (textLen > bufsize) {
-			bufsize += MAXCIPHERLEN;
-			encText = g_realloc(encText, bufsize);
-			decText = g_realloc(decText, bufsize);
-		}
+  if (status == FALSE) {
+    return FALSE;
+  }
 
-		if (isalpha(c)) {
-			encText[textLen++] = tolower(c);
-      freq[tolower(c)-'a'] += 1;
-		}
-	}
+	printf("\nCryptogram file \'%s\' loaded", file);
+	printf("\nLength: %d characters", ctx->textLen);
+	printf("\nDistinct %d-grams: %d\n\n", ngramLen, ctx->numHist);
 
-  fclose(fp);
+  printf("PROBABLE VOWELS: ");
 
-  /* Read in correct solution if given */
-  if (solution != NULL) {
-    if ((fp = fopen(solution, "r")) == NULL) {
-      g_critical("Error opening file '%s' for reading\n", solution);
-      return FALSE;
+  for (int i = 0; i < ctx->numVowels; i++) {
+    printf("%c ", ctx->vowels[i]);
+  }
+
+  printf("\n\n");
+
+  return TRUE;
+}
+
+
+/**
+ * cryptoLoadText: Load a cryptogram from a string. Only the letters of
+ *                 @text count; everything else is skipped.
+ *
+ * @text: Ciphertext
+ * @solution: Text of the correct solution, or NULL
+ *
+ * @Return: FALSE if an error occurs
+ **/
+gboolean
+cryptoLoadText (solveContext *ctx,
+                const char   *text,
+                const char   *solution)
+{
+  gsize bufsize = strlen(text) + 1;
+
+  ctx->encText = g_malloc(bufsize);
+  ctx->decText = g_malloc(bufsize);
+  ctx->textLen = 0;
+
+  for (const char *c = text; *c != NUL; c++) {
+    if (isalpha(*c)) {
+      ctx->encText[ctx->textLen++] = tolower(*c);
+      ctx->freq[tolower(*c)-'a'] += 1;
     }
+  }
 
-    solText = g_malloc(bufsize);
+  if (ctx->textLen < ngramLen) {
+    g_critical("Cryptogram is shorter than the n-gram length\n");
+    return FALSE;
+  }
 
+  if (solution != NULL) {
     int solLen = 0;
 
-    while (!feof(fp)) {
-      int c = getc(fp);
-
-      if (solLen > bufsize) {
-        bufsize += MAXCIPHERLEN;
-        solText = g_realloc(solText, bufsize);
-      }        
+    ctx->solText = g_malloc0(MAX(strlen(solution), bufsize));
 
-      if (isalpha(c)) {
-        solText[solLen++] = tolower(c);
+    for (const char *c = solution; *c != NUL; c++) {
+      if (isalpha(*c)) {
+        ctx->solText[solLen++] = tolower(*c);
       }
     }
 
-    if (solLen != textLen) {
+    if (solLen != ctx->textLen) {
       g_warning("Length of solution is incorrect\n");
     }
-
-    fclose(fp);
   }
 
-	printf("\nCryptogram file \'%s\' loaded", file);
-	printf("\nLength: %d characters\n\n", textLen);
+  /* Scoring kernels stream over the ciphertext as symbol indices */
+  ctx->encSymBuf = g_malloc0(ctx->textLen + SYMALIGN + SYMPAD);
+  ctx->encSym    = (guint8 *) (((gsize) ctx->encSymBuf + SYMALIGN-1) &
+                               ~(gsize) (SYMALIGN-1));
+
+  for (int i = 0; i < ctx->textLen; i++) {
+    ctx->encSym[i] = ctx->encText[i]-'a';
+  }
 
-  vowIdentify();
-  srand(time(0));
+  cryptoIndexInit(ctx);
+  cryptoHistInit(ctx);
+  vowIdentify(ctx);
 
   return TRUE;
 }
 
 
 /**
- * cryptoFree: Clean up allocated resources
+ * cryptoFree: Free the context of a solve and everything it holds
  *
  * @Returns: FALSE if an error occurs
  **/
 gboolean
-cryptoFree (void)
+cryptoFree (solveContext *ctx)
 {
-  g_free(encText);
-  g_free(decText);
+  g_free(ctx->encText);
+  g_free(ctx->encSymBuf);
+  g_free(ctx->decText);
+  g_free(ctx->solText);
+
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    g_free(ctx->swapWin[i]);
+  }
+
+  g_free(ctx->histGram);
+  g_free(ctx->histCount);
+
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    g_free(ctx->histWin[i]);
+  }
+
+  g_free(ctx);
 
   return TRUE;
 }
@@ -149,78 +276,771 @@ cryptoFree (void)
  * @Returns: Numeric score between -INFINITY and 0 (closer to 0 is better)
  **/
 double
-cryptoEval (char *key)
+cryptoEval (solveContext *ctx,
+            char         *key)
 {
-  char tryText[textLen];
-  
-  for (int i = 0; i < textLen; i++) {
-    tryText[i] = key[encText[i]-'a'];
+  g_atomic_int_inc(&ctx->evalCount);
+
+  if (ctx->useHist == TRUE) {
+    return cryptoEvalHist(ctx, key);
+  }
+
+  guint8 keySym[KERNELKEYLEN];
+
+  memset(keySym, 0, KERNELKEYLEN);
+
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    keySym[i] = key[i]-'a';
   }
 
-  return scoreEval(tryText, textLen);
+  return scoreEvalKey(ctx->encSym, ctx->textLen, keySym);
 }
 
 
 /**
- * cryptoSolve: Solve a cryptogram
+ * cryptoEvalBatch: Evaluate many potential decryption keys, walking the
+ *                  ciphertext once for every KERNELBATCH keys
  *
- * @Returns: Best decryption key found
+ * @keys: The decryption keys to evaluate
+ * @nkeys: Number of keys
+ * @scores: Address where to store the scores, as returned by cryptoEval
+ *
+ * @Returns: Nothing
  **/
 void
-cryptoSolve (void)
+cryptoEvalBatch (solveContext *ctx,
+                 char        **keys,
+                 int           nkeys,
+                 double       *scores)
 {
-  GTimer      *timer = g_timer_new();
-  GThreadPool *tpool;
-  
-  bestFit   = -INFINITY;
-  bestTrial = 0;
-  bestGen   = 0;
+  g_atomic_int_add(&ctx->evalCount, nkeys);
 
-  numLeft   = numTrials;
+  if (ctx->useHist == TRUE) {
+    for (int k = 0; k < nkeys; k++) {
+      scores[k] = cryptoEvalHist(ctx, keys[k]);
+    }
+    return;
+  }
+
+  guint8 keySoA[NUMSYMBOLS * KERNELBATCH];
 
-  updateBestMutex = g_mutex_new();
+  for (int base = 0; base < nkeys; base += KERNELBATCH) {
+    int count = MIN(KERNELBATCH, nkeys - base);
 
-  tpool = g_thread_pool_new(genSolve, NULL, maxThreads, TRUE, NULL);
+    for (int c = 0; c < NUMSYMBOLS; c++) {
+      for (int k = 0; k < count; k++) {
+        keySoA[c * KERNELBATCH + k] = keys[base+k][c]-'a';
+      }
+    }
 
-  for (int i = 1; i <= numTrials; i++) {
-    g_thread_pool_push(tpool, GINT_TO_POINTER(i), NULL);
+    scoreEvalBatch(ctx->encSym, ctx->textLen, keySoA, count, &scores[base]);
   }
+}
+
+
+/**
+ * cryptoBench: Compare the speed of scoring random keys one at a time
+ *              with cryptoEval and together with cryptoEvalBatch
+ *
+ * @Returns: Nothing
+ **/
+void
+cryptoBench (solveContext *ctx)
+{
+  char    *keys[popSize];
+  double   single[popSize];
+  double   batch[popSize];
+  GTimer  *timer = g_timer_new();
+  int      rounds = MAX(1, 20000000 / (ctx->textLen * popSize));
+  rngState rng;
+
+  rngInit(&rng, ctx->seed, 0);
+
+  for (int k = 0; k < popSize; k++) {
+    keys[k] = g_malloc(NUMSYMBOLS+1);
+
+    for (int i = 0; i < NUMSYMBOLS; i++) {
+      keys[k][i] = 'a'+i;
+    }
+    keys[k][NUMSYMBOLS] = NUL;
+
+    for (int i = NUMSYMBOLS-1; i > 0; i--) {
+      int  j = rngInt(&rng, i+1);
+      char tmp = keys[k][i];
+
+      keys[k][i] = keys[k][j];
+      keys[k][j] = tmp;
+    }
+  }
+
+  g_timer_start(timer);
 
-  guint tleft;
-  guint trunning;
+  for (int r = 0; r < rounds; r++) {
+    for (int k = 0; k < popSize; k++) {
+      single[k] = cryptoEval(ctx, keys[k]);
+    }
+  }
+
+  double singleTime = g_timer_elapsed(timer, NULL);
+
+  g_timer_start(timer);
+
+  for (int r = 0; r < rounds; r++) {
+    cryptoEvalBatch(ctx, keys, popSize, batch);
+  }
+
+  double batchTime = g_timer_elapsed(timer, NULL);
+  int    mismatch = 0;
+
+  for (int k = 0; k < popSize; k++) {
+    if (memcmp(&single[k], &batch[k], sizeof(double)) != 0) {
+      mismatch += 1;
+    }
+    g_free(keys[k]);
+  }
+
+  printf("Per-key loop:  %.0f keys/sec\n", rounds * popSize / singleTime);
+  printf("Batch:         %.0f keys/sec\n", rounds * popSize / batchTime);
+  printf("Mismatched scores: %d of %d\n", mismatch, popSize);
+
+  g_timer_destroy(timer);
+}
+
+
+/**
+ * cryptoEvalSwap: Evaluate a decryption key with two of its entries swapped,
+ *                 rescoring only the n-grams that contain the swapped letters
+ *
+ * @key: The decryption key before the swap
+ * @oldScore: Score of @key as returned by cryptoEval
+ * @x: Index of first key entry to swap
+ * @y: Index of second key entry to swap
+ *
+ * @Returns: Score of the key with entries @x and @y swapped
+ **/
+double
+cryptoEvalSwap (solveContext *ctx,
+                char         *key,
+                double        oldScore,
+                int           x,
+                int           y)
+{
+  return cryptoEvalSwapBounded(ctx, key, oldScore, x, y, -INFINITY);
+}
+
+
+/**
+ * cryptoEvalSwapBounded: Evaluate a decryption key with two of its entries
+ *                        swapped, like cryptoEvalSwap, for a caller that
+ *                        only wants the swap if it scores at least
+ *                        @threshold. Since n-gram scores are never above
+ *                        0, rescoring stops as soon as the n-grams left
+ *                        cannot bring the score up to @threshold.
+ *
+ * @key: The decryption key before the swap
+ * @oldScore: Score of @key as returned by cryptoEval
+ * @x: Index of first key entry to swap
+ * @y: Index of second key entry to swap
+ * @threshold: Lowest score of interest
+ *
+ * @Returns: Score of the key with entries @x and @y swapped if it is at
+ *           least @threshold, otherwise some score below @threshold
+ **/
+double
+cryptoEvalSwapBounded (solveContext *ctx,
+                       char         *key,
+                       double        oldScore,
+                       int           x,
+                       int           y,
+                       double        threshold)
+{
+  guint8 keySym[KERNELKEYLEN];
+
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    keySym[i] = key[i]-'a';
+  }
+
+  if (ctx->useHist == TRUE) {
+    int **hw = ctx->histWin;
+    int  *hn = ctx->histWinLen;
+
+    double score = oldScore -
+                   scoreEvalHistWin(ctx->encSym, ctx->histGram, ctx->histCount,
+                                    hw[x], hn[x], hw[y], hn[y], keySym);
+
+    keySym[x] = key[y]-'a';
+    keySym[y] = key[x]-'a';
+
+    return score + scoreEvalHistWinBounded(ctx->encSym, ctx->histGram,
+                                           ctx->histCount,
+                                           hw[x], hn[x], hw[y], hn[y], keySym,
+                                           threshold - score - BOUNDSLACK);
+  }
+
+  int **sw = ctx->swapWin;
+  int  *sn = ctx->swapLen;
+
+  double score = oldScore - scoreEvalWin(ctx->encSym, sw[x], sn[x],
+                                         sw[y], sn[y], keySym);
+
+  keySym[x] = key[y]-'a';
+  keySym[y] = key[x]-'a';
+
+  score += scoreEvalWinBounded(ctx->encSym, sw[x], sn[x], sw[y], sn[y],
+                               keySym, threshold - score - BOUNDSLACK);
+
+  return score;
+}
+
+
+/**
+ * cryptoEvalHist: Evaluate a potential decryption key over the histogram
+ *                 of distinct ciphertext n-grams. Agrees with scoreEval on
+ *                 the decrypted text bit for bit over quantized tables,
+ *                 and up to floating point summation order otherwise.
+ *
+ * @key: The decryption key to evaluate
+ *
+ * @Returns: Numeric score between -INFINITY and 0 (closer to 0 is better)
+ **/
+static double
+cryptoEvalHist (solveContext *ctx,
+                char         *key)
+{
+  guint8 keySym[KERNELKEYLEN];
+
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    keySym[i] = key[i]-'a';
+  }
+
+  return scoreEvalHist(ctx->encSym, ctx->histGram, ctx->histCount,
+                       ctx->numHist, keySym);
+}
+
+
+/**
+ * cryptoHistInit: Count the distinct n-grams of the ciphertext and decide
+ *                 whether scoring over them is cheaper than a text scan
+ *
+ * @Returns: Nothing
+ **/
+static void
+cryptoHistInit (solveContext *ctx)
+{
+  GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free, NULL);
+  int numGrams = MAX(ctx->textLen-ngramLen+1, 0);
+
+  ctx->histGram  = g_malloc(MAX(numGrams, 1) * ngramLen);
+  ctx->histCount = g_new(int, MAX(numGrams, 1));
+  ctx->numHist   = 0;
+
+  for (int i = 0; i < numGrams; i++) {
+    gchar   *gram = g_strndup(&ctx->encText[i], ngramLen);
+    gpointer slot = g_hash_table_lookup(seen, gram);
+
+    if (slot != NULL) {
+      ctx->histCount[GPOINTER_TO_INT(slot)-1] += 1;
+      g_free(gram);
+    } else {
+      for (int k = 0; k < ngramLen; k++) {
+        ctx->histGram[ctx->numHist*ngramLen+k] = gram[k]-'a';
+      }
+      ctx->histCount[ctx->numHist] = 1;
+      ctx->numHist += 1;
+      g_hash_table_insert(seen, gram, GINT_TO_POINTER(ctx->numHist));
+    }
+  }
+
+  g_hash_table_destroy(seen);
+
+  /* Each histogram entry costs about ngramLen times a text position */
+  ctx->useHist = (ctx->numHist * ngramLen < ctx->textLen &&
+                  (scoreHistExact() == TRUE || histScoring == TRUE));
+
+  if (ctx->useHist == TRUE && cryptoHistCheck(ctx) == FALSE) {
+    g_warning("Histogram scoring disagrees with a full evaluation\n");
+    ctx->useHist = FALSE;
+  }
+
+  if (ctx->useHist == FALSE) {
+    return;
+  }
+
+  int **win = ctx->histWin;
+  int  *len = ctx->histWinLen;
+
+  for (int c = 0; c < NUMSYMBOLS; c++) {
+    win[c] = g_new(int, ctx->numHist+1);
+    len[c] = 0;
+  }
+
+  for (int k = 0; k < ngramLen-1; k++) {
+    int c = ctx->encSym[k];
+
+    if (len[c] == 0) {
+      win[c][len[c]++] = -1;
+    }
+  }
+
+  for (int e = 0; e < ctx->numHist; e++) {
+    for (int k = 0; k < ngramLen; k++) {
+      int c = ctx->histGram[e*ngramLen+k];
+
+      if (len[c] == 0 || win[c][len[c]-1] < e) {
+        win[c][len[c]++] = e;
+      }
+    }
+  }
+}
+
+
+/**
+ * cryptoHistCheck: Compare scoring over the histogram with a scan of the
+ *                  ciphertext on random keys
+ *
+ * @Returns: FALSE if any score differs in any bit, or with --histogram
+ *           over double tables by more than HISTCHECKTOL relative
+ **/
+static gboolean
+cryptoHistCheck (solveContext *ctx)
+{
+  char    key[NUMSYMBOLS+1];
+  guint8  keySym[KERNELKEYLEN];
+  guint32 seed = 24680;
+
+  memcpy(key, "abcdefghijklmnopqrstuvwxyz", NUMSYMBOLS+1);
+  memset(keySym, 0, KERNELKEYLEN);
+
+  for (int k = 0; k < HISTCHECKKEYS; k++) {
+    for (int i = NUMSYMBOLS-1; i > 0; i--) {
+      seed = seed * 1103515245 + 12345;
+
+      int  j = (seed >> 16) % (i+1);
+      char tmp = key[i];
+
+      key[i] = key[j];
+      key[j] = tmp;
+    }
+
+    for (int i = 0; i < NUMSYMBOLS; i++) {
+      keySym[i] = key[i]-'a';
+    }
+
+    double want = scoreEvalKey(ctx->encSym, ctx->textLen, keySym);
+    double got  = cryptoEvalHist(ctx, key);
+
+    if (scoreHistExact() == TRUE) {
+      if (memcmp(&want, &got, sizeof(double)) != 0) {
+        return FALSE;
+      }
+    } else if (!(fabs(got - want) <= HISTCHECKTOL * fabs(want))) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+
+/**
+ * cryptoIndexInit: Build the list of scoring windows touched by each
+ *                  ciphertext letter
+ *
+ * @Returns: Nothing
+ **/
+static void
+cryptoIndexInit (solveContext *ctx)
+{
+  int **win = ctx->swapWin;
+  int  *len = ctx->swapLen;
+
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    win[i] = g_new(int, ctx->freq[i] * ngramLen);
+    len[i] = 0;
+  }
+
+  for (int p = 0; p < ctx->textLen; p++) {
+    int c     = ctx->encText[p]-'a';
+    int first = MAX(p, ngramLen-2);
+    int last  = MIN(p+ngramLen-1, ctx->textLen-1);
+
+    for (int w = first; w <= last; w++) {
+      if (len[c] == 0 || win[c][len[c]-1] < w) {
+        win[c][len[c]++] = w;
+      }
+    }
+  }
+}
+
+
+/**
+ * cryptoPublish: Record a trial's best key as the overall best key of the
+ *                solve if it scores higher. Ties go to the lower trial
+ *                number, so that runs are reproducible. Trials should only
+ *                offer keys that beat their own best.
+ *
+ * @key: Best key found by the trial
+ * @fit: Score of @key
+ * @trial: Number of the trial
+ * @gen: Generation in which @key was found
+ *
+ * @Returns: Nothing
+ **/
+void
+cryptoPublish (solveContext *ctx,
+               const char   *key,
+               double        fit,
+               int           trial,
+               int           gen)
+{
+  bestRecord *rec = NULL;
+  bestRecord *old;
+
+  g_atomic_int_inc(&ctx->publishOffers);
 
   do {
-    tleft = g_thread_pool_unprocessed(tpool);
-    trunning = g_thread_pool_get_num_threads(tpool);
-    guint etime = g_timer_elapsed(timer, NULL);
+    old = g_atomic_pointer_get(&ctx->bestRec);
 
-		printf("\rThreads Running: %d\tIn Queue: %3d\tElapsed Time: %02d:%02d:%02d",
-		       trunning, tleft, etime / 3600, (etime % 3600) / 60, etime % 60);
-		fflush(stdout);
-		
-		g_usleep(G_USEC_PER_SEC / 5);
-	} while (numLeft > 0);
+    if (old != NULL &&
+        !(fit > old->fit || (fit == old->fit && trial < old->trial))) {
+      g_free(rec);
+      return;
+    }
 
-	g_thread_pool_free(tpool, FALSE, TRUE);
-	g_timer_destroy(timer);
+    if (rec == NULL) {
+      rec = g_new(bestRecord, 1);
+      strcpy(rec->key, key);
+      rec->fit   = fit;
+      rec->trial = trial;
+      rec->gen   = gen;
+    }
+
+    rec->prev = old;
+  } while (!g_atomic_pointer_compare_and_exchange(&ctx->bestRec, old, rec));
+
+  g_atomic_int_inc(&ctx->publishUpdates);
 
-  g_mutex_free(updateBestMutex);
+  if (ctx->targetScore < 0.0 && fit >= ctx->targetScore) {
+    g_atomic_int_set(&ctx->cancel, TRUE);
+  }
 }
 
 
 /**
- * cryptoPrint: Print best solution
+ * cryptoSolve: Solve a cryptogram on a pool of its own, as the command
+ *              line tool does
+ *
+ * @Returns: Nothing
+ **/
+void
+cryptoSolve (solveContext *ctx)
+{
+  printf("Random seed: %" G_GINT64_FORMAT "\n", ctx->seed);
+
+  workPool *pool = poolNew(maxThreads);
+
+  cryptoRun(ctx, pool);
+  poolFree(pool);
+}
+
+
+/**
+ * cryptoRun: Run the trials of a solve on a pool and wait for them. The
+ *            pool may be running the trials of other solves at the same
+ *            time. The result is left in the bestKey, bestFit, bestTrial
+ *            and bestGen fields of @ctx.
+ *
+ * @pool: Pool to run the trials, which the caller must not be a worker of
+ *
+ * @Returns: Nothing
+ **/
+void
+cryptoRun (solveContext *ctx,
+           workPool     *pool)
+{
+  ctx->bestFit   = -INFINITY;
+  ctx->bestTrial = 0;
+  ctx->bestGen   = 0;
+  ctx->bestRec   = NULL;
+
+  ctx->publishOffers  = 0;
+  ctx->publishUpdates = 0;
+  ctx->memoHits       = 0;
+  ctx->memoMisses     = 0;
+  ctx->evalCount      = 0;
+  ctx->cancel         = FALSE;
+  ctx->group.pending  = 0;
+
+  ctx->timer = g_timer_new();
+
+  GFunc solver = (solverType == SOLVEANNEAL) ? annealSolve : genSolve;
+
+  if (migrateInterval > 0) {
+    islandInit(ctx, MIN(maxThreads, ctx->numTrials));
+  }
+
+  if (raceEta > 0) {
+    cryptoRace(ctx, pool);
+  } else {
+    for (int i = 1; i <= ctx->numTrials; i++) {
+      poolPush(pool, solver, GINT_TO_POINTER(i), ctx, &ctx->group);
+    }
+
+    cryptoWait(ctx, pool);
+  }
+
+  if (migrateInterval > 0) {
+    islandFree(ctx);
+  }
+
+  bestRecord *rec = ctx->bestRec;
+
+  if (rec != NULL) {
+    strcpy(ctx->bestKey, rec->key);
+    ctx->bestFit   = rec->fit;
+    ctx->bestTrial = rec->trial;
+    ctx->bestGen   = rec->gen;
+  } else {
+    /* Cancelled before any trial finished a generation */
+    for (int i = 0; i < NUMSYMBOLS; i++) {
+      ctx->bestKey[i] = 'a'+i;
+    }
+    ctx->bestKey[NUMSYMBOLS] = NUL;
+    ctx->bestFit = cryptoEval(ctx, ctx->bestKey);
+  }
+
+  while (rec != NULL) {
+    bestRecord *prev = rec->prev;
+
+    g_free(rec);
+    rec = prev;
+  }
+
+  ctx->bestRec = NULL;
+  ctx->elapsed = g_timer_elapsed(ctx->timer, NULL);
+
+  g_timer_destroy(ctx->timer);
+  ctx->timer = NULL;
+}
+
+
+/**
+ * cryptoWait: Wait until the pool has run all queued trials of a solve.
+ *             While waiting, the progress line is redrawn at most once per
+ *             interval, and the trials are cancelled once the time limit
+ *             has passed.
+ *
+ * @pool: Pool running the trials
+ *
+ * @Returns: Nothing
+ **/
+static void
+cryptoWait (solveContext *ctx,
+            workPool     *pool)
+{
+  for (;;) {
+    gint64 timeout = (progressInterval > 0) ? progressInterval * 1000 : -1;
+
+    if (ctx->timeLimit > 0.0 && g_atomic_int_get(&ctx->cancel) == FALSE) {
+      double left = ctx->timeLimit - g_timer_elapsed(ctx->timer, NULL);
+
+      /* Clamped before the conversion, which a huge limit would overflow */
+      left    = CLAMP(left, 0.0, MAXWAIT) * G_USEC_PER_SEC;
+      timeout = (timeout < 0) ? (gint64) left : MIN(timeout, (gint64) left);
+    }
+
+    if (poolWait(pool, &ctx->group, timeout) == TRUE) {
+      break;
+    }
+
+    if (ctx->timeLimit > 0.0 &&
+        g_timer_elapsed(ctx->timer, NULL) >= ctx->timeLimit) {
+      g_atomic_int_set(&ctx->cancel, TRUE);
+    }
+
+    if (progressInterval > 0) {
+      cryptoProgress(pool, ctx->timer);
+    }
+  }
+
+  if (progressInterval > 0) {
+    cryptoProgress(pool, ctx->timer);
+  }
+}
+
+
+/**
+ * cryptoRace: Race GA trials in rounds of successive halving
+ *
+ * @pool: Pool to run the trials
+ *
+ * @Returns: Nothing
+ **/
+static void
+cryptoRace (solveContext *ctx,
+            workPool     *pool)
+{
+  raceEntry *live = g_new0(raceEntry, ctx->numTrials);
+  int        numLive = ctx->numTrials;
+  int        rounds = 1;
+
+  for (int n = ctx->numTrials; n > 1; n = (n + raceEta-1) / raceEta) {
+    rounds += 1;
+  }
+
+  for (int i = 0; i < ctx->numTrials; i++) {
+    live[i].ctx   = ctx;
+    live[i].trial = i+1;
+  }
+
+  for (int r = 0; r < rounds; r++) {
+    int gens = maxGens;
+
+    for (int k = r; k < rounds-1; k++) {
+      gens /= raceEta;
+    }
+
+    for (int i = 0; i < numLive; i++) {
+      poolPush(pool, cryptoRaceTask, &live[i], GINT_TO_POINTER(MAX(gens, 1)),
+               &ctx->group);
+    }
+
+    cryptoWait(ctx, pool);
+
+    if (g_atomic_int_get(&ctx->cancel) == TRUE) {
+      break;
+    }
+
+    /* Keep the best trials for the next round */
+    qsort(live, numLive, sizeof(raceEntry), cryptoRaceCompare);
+
+    int keep = (numLive + raceEta-1) / raceEta;
+
+    for (int i = keep; i < numLive; i++) {
+      genTrialFree(live[i].state);
+      live[i].state = NULL;
+    }
+
+    numLive = keep;
+  }
+
+  for (int i = 0; i < numLive; i++) {
+    if (live[i].state != NULL) {
+      genTrialFree(live[i].state);
+    }
+  }
+
+  g_free(live);
+}
+
+
+/**
+ * cryptoRaceTask: Run a raced trial up to its budget for this round
+ *
+ * @data: Race entry of the trial
+ * @udata: Generations the trial should have run at the end of the round
+ *
+ * @Returns: Nothing
+ **/
+static void
+cryptoRaceTask (gpointer data,
+                gpointer udata)
+{
+  raceEntry *entry = data;
+
+  if (g_atomic_int_get(&entry->ctx->cancel) == TRUE) {
+    return;
+  }
+
+  if (entry->state == NULL) {
+    entry->state = genTrialNew(entry->ctx, entry->trial);
+  }
+
+  genTrialRun(entry->state, GPOINTER_TO_INT(udata));
+}
+
+
+/**
+ * cryptoRaceCompare: Order race entries by descending best score, then
+ *                    by trial number
+ *
+ * @Returns: Negative if @a ranks first, positive if @b ranks first
+ **/
+static int
+cryptoRaceCompare (const void *a,
+                   const void *b)
+{
+  const raceEntry *x = a;
+  const raceEntry *y = b;
+  double fx = genTrialFit(x->state);
+  double fy = genTrialFit(y->state);
+
+  if (fx != fy) {
+    return (fx > fy) ? -1 : 1;
+  }
+
+  return x->trial - y->trial;
+}
+
+
+/**
+ * cryptoProgress: Redraw the progress line of a solve
+ *
+ * @pool: Pool running the trials
+ * @timer: Timer started with the solve
+ *
+ * @Returns: Nothing
+ **/
+static void
+cryptoProgress (workPool *pool,
+                GTimer   *timer)
+{
+  int   queued;
+  int   running;
+  guint etime = g_timer_elapsed(timer, NULL);
+
+  poolStatus(pool, &queued, &running);
+
+  printf("\rTasks Running: %d\tIn Queue: %3d\tElapsed Time: %02d:%02d:%02d",
+         running, queued, etime / 3600, (etime % 3600) / 60, etime % 60);
+  fflush(stdout);
+}
+
+
+/**
+ * cryptoDecrypt: Decrypt the ciphertext into the decText field
  *
  * @key: Decryption key
  *
  * @Returns: Nothing
  **/
 void
-cryptoPrint (char *key)
+cryptoDecrypt (solveContext *ctx,
+               const char   *key)
 {
-  for (int i = 0; i < textLen; i++) {
-    decText[i] = key[encText[i]-'a'];
+  for (int i = 0; i < ctx->textLen; i++) {
+    ctx->decText[i] = key[ctx->encText[i]-'a'];
   }
+}
+
+
+/**
+ * cryptoPrint: Print best solution
+ *
+ * @key: Decryption key
+ *
+ * @Returns: Nothing
+ **/
+void
+cryptoPrint (solveContext *ctx,
+             char         *key)
+{
+  char *encText = ctx->encText;
+  char *decText = ctx->decText;
+  int   textLen = ctx->textLen;
+
+  cryptoDecrypt(ctx, key);
 
   printf("\n\n");
   
@@ -26,34 +26,111 @@
 
 
 #define MAXSWAPS        100
+#define SEEDSWAPS       20      // Most swaps perturbing a frequency-matched key
+#define SEEDSPREAD      3       // Most ranks apart of two letters so swapped
+#define MATECHUNK       16      // Children bred by one mating task
+#define GENKEYSTRIDE    32      // Bytes between keys in the arena
+#define GENALIGN        64      // Alignment of the arena
+#define GENFITSLACK     1e-6    // Score difference of copies of a key
 
 
-static void genInit   (char **popKey, double *popFit);
-static void genMate   (char **popKey, double *popFit);
-static void genMutate (char **popKey, double *popFit);
-static int  genSelect (void);
-
-static void genCrossover (char **popKey,
-                          int    x,
-                          int    y,
-                          char  *child);
+/*
+ * The keys of a trial live in one arena holding two generations of
+ * popSize keys each. popKey points at the keys of the current generation
+ * in order of descending fitness: genSort reorders the pointers and
+ * fitness values, never the keys themselves. genMate writes the children
+ * into the other generation and then points popKey at them, so the old
+ * parents become the space for the next children. Steady-state trials
+ * breed into the other generation too, but copy each child they keep
+ * over the key it replaces.
+ */
 
-static void genSort   (char  **popKey,
-                       double *popFit);
 
+/*
+ * genMate breeds the child generation in chunks of MATECHUNK children.
+ * When running in a work-stealing pool, the chunks are queued as tasks
+ * that idle workers can take over. Each chunk draws from its own random
+ * number generator, seeded from the trial's generator, so the children
+ * do not depend on which thread breeds them.
+ */
+struct s_mateTask {
+  solveContext *ctx;
+  char    **popKey;
+  double   *popFit;
+  char     *child;        // First key of the child generation
+  int       first;
+  int       last;
+  rngState  rng;
+};
+
+typedef struct s_mateTask mateTask;
+
+
+static void genInit   (solveContext *ctx, char **popKey, double *popFit,
+                       rngState *rng, fitMemo *memo);
+static void genMate   (solveContext *ctx, char **popKey, double *popFit,
+                       char *child, rngState *rng, fitMemo *memo);
+static void genEval   (solveContext *ctx, char **popKey, double *popFit,
+                       int num, fitMemo *memo);
+static int  genDiversity (double *popFit);
+static void genSeedFreq  (solveContext *ctx, char **popKey, rngState *rng);
+static void genRank      (const double *weight, int *rank);
+static void genMutate (solveContext *ctx, char **popKey, double *popFit,
+                       int num, rngState *rng);
+static void genSteady (genTrial *t, int gen);
+static void genBest   (genTrial *t, int gen);
+static gboolean genInsert (char **popKey, double *popFit, const char *key,
+                           double fit);
+static int  genSelect (rngState *rng);
+static void genMateTask (gpointer data, gpointer udata);
+
+static int  genCrossover (solveContext *ctx,
+                          char        **popKey,
+                          double       *popFit,
+                          int           x,
+                          int           y,
+                          char         *child);
+
+static void genSort   (genTrial *t);
+
+
+double  unigramProb[NUMSYMBOLS];
 
-GMutex *updateBestMutex = NULL;
 
-char    bestKey[NUMSYMBOLS+1];
-double  bestFit;
-int     bestTrial;
-int     bestGen;
+/*
+ * The state of a GA trial is kept in a genTrial, so that a trial can be
+ * run for some generations, set aside and resumed later. genSolve runs
+ * a trial in one go; the racing scheduler in cryptoSolve runs many trials
+ * in rounds and resumes only the best.
+ */
+struct s_genTrial {
+  solveContext *ctx;
+  char    **popKey;
+  double   *popFit;
+  char     *arenaBuf;
+  char     *arena[2];
+  int       cur;                // Generation popKey points into
+  char    **childKey;           // Offspring of a steady-state step
+  double   *childFit;
+  int      *sortOrder;          // Scratch space of genSort
+  char    **sortKey;
+  double   *sortFit;
+  int       gen;                // Generations run so far
+  gboolean  done;               // Given up as stagnant
+  double    trialFit;           // Best score of the trial
+  double    runFit;             // Best score since the last restart
+  int       runGen;             // Generation of the last improvement
+  fitMemo  *memo;
+  rngState  rng;
+  int       trialNum;
+};
 
 
 /**
  * genSolve: Solve cryptogram using genetic algorithm
  *
  * @trial: Number of current trial
+ * @udata: Solve the trial belongs to
  *
  * @Returns: Nothing
  **/
@@ -61,46 +138,334 @@ void
 genSolve (gpointer trial,
           gpointer udata)
 {
-  char   *popKey[popSize];
-  double *popFit;
+  solveContext *ctx = udata;
+
+  if (g_atomic_int_get(&ctx->cancel) == TRUE) {
+    return;
+  }
+
+  genTrial *t = genTrialNew(ctx, GPOINTER_TO_INT(trial));
+
+  genTrialRun(t, maxGens);
+  genTrialFree(t);
+}
+
+
+/**
+ * genTrialNew: Start a GA trial with a random population
+ *
+ * @ctx: Solve the trial belongs to
+ * @trial: Number of the trial
+ *
+ * @Returns: New trial
+ **/
+genTrial *
+genTrialNew (solveContext *ctx,
+             int           trial)
+{
+  genTrial *t = g_new0(genTrial, 1);
+
+  t->ctx       = ctx;
+  t->trialNum  = trial;
+  t->popKey    = g_new(char *, popSize);
+  t->popFit    = g_new(double, popSize);
+  t->arenaBuf  = g_malloc(2 * popSize * GENKEYSTRIDE + GENALIGN);
+  t->childKey  = g_new(char *, MAX(steadyOffspring, 1));
+  t->childFit  = g_new(double, MAX(steadyOffspring, 1));
+  t->sortOrder = g_new(int, 2 * popSize);
+  t->sortKey   = g_new(char *, popSize);
+  t->sortFit   = g_new(double, popSize);
+  t->trialFit  = -INFINITY;
+  t->runFit    = -INFINITY;
+  t->memo      = memoNew();
+
+  rngInit(&t->rng, ctx->seed, trial);
+
+  t->arena[0] = (char *) (((gsize) t->arenaBuf + GENALIGN-1) &
+                          ~(gsize) (GENALIGN-1));
+  t->arena[1] = t->arena[0] + popSize * GENKEYSTRIDE;
 
   for (int i = 0; i < popSize; i++) {
-    popKey[i] = g_malloc(NUMSYMBOLS+1);
+    t->popKey[i] = t->arena[t->cur] + i * GENKEYSTRIDE;
   }
 
-  popFit = g_malloc(popSize * sizeof(double));
+  genInit(ctx, t->popKey, t->popFit, &t->rng, t->memo);
+  genSort(t);
 
-  genInit(popKey, popFit);
-  genSort(popKey, popFit);
+  return t;
+}
 
-  for (int j = 1; j <= maxGens; j++) {
-    genMate(popKey, popFit);
-    genSort(popKey, popFit);
 
-    g_mutex_lock(updateBestMutex);
-  
-    if (popFit[0] > bestFit && strcmp(bestKey, popKey[0])) {
-      strcpy(bestKey, popKey[0]);
-      bestFit   = popFit[0];
-      bestTrial = GPOINTER_TO_INT(trial);
-      bestGen   = j;
+/**
+ * genTrialRun: Run a GA trial until it has completed a number of
+ *              generations in total, it gives up, or the solve is
+ *              cancelled
+ *
+ * @t: Trial
+ * @gens: Generations to have run when done (at most maxGens)
+ *
+ * @Returns: Nothing
+ **/
+void
+genTrialRun (genTrial *t,
+             int       gens)
+{
+  solveContext *ctx = t->ctx;
+  char   **popKey = t->popKey;
+  double  *popFit = t->popFit;
+  int      island = -1;
+
+  gens = MIN(gens, maxGens);
+
+  /* Without a free island the trial runs without migration */
+  if (migrateInterval > 0) {
+    island = islandClaim(ctx);
+  }
+
+  while (t->gen < gens && t->done == FALSE) {
+    int j = ++t->gen;
+
+    if (steadyOffspring > 0) {
+      genSteady(t, j);
+    } else {
+      genMate(ctx, popKey, popFit, t->arena[1-t->cur], &t->rng, t->memo);
+      t->cur = 1-t->cur;
+      genSort(t);
+      genBest(t, j);
+
+      genMutate(ctx, popKey, popFit, popSize, &t->rng);
+      genSort(t);
+    }
+
+    if (island >= 0 && j % migrateInterval == 0) {
+      islandSend(ctx, island, popKey, popFit);
+
+      if (islandReceive(ctx, island, popKey, popFit) > 0) {
+        genSort(t);
+      }
+    }
+
+    if (g_atomic_int_get(&ctx->cancel) == TRUE) {
+      break;
     }
 
-    g_mutex_unlock(updateBestMutex);
-   
-    genMutate(popKey, popFit);
-    genSort(popKey, popFit);
+    /* A population that stopped improving, or whose keys have become
+       nearly all alike, is replaced or given up */
+    if ((stagnantGens > 0 && j - t->runGen >= stagnantGens) ||
+        (minDiversity > 0 && genDiversity(popFit) < minDiversity)) {
+      if (restartTrials == FALSE) {
+        t->done = TRUE;
+        break;
+      }
+
+      genInit(ctx, popKey, popFit, &t->rng, t->memo);
+      genSort(t);
+      t->runFit = -INFINITY;
+      t->runGen = j;
+    }
   }
 
-  for (int i = 0; i < popSize; i++) {
-    g_free(popKey[i]);
+  if (island >= 0) {
+    islandRelease(ctx, island);
+  }
+}
+
+
+/**
+ * genSteady: Run one generation of a steady-state GA trial. Children are
+ *            bred steadyOffspring at a time, scored, mutated and then
+ *            inserted into the ranked population in place of its weakest
+ *            keys, so that they can be parents of the next children at
+ *            once. A generation breeds popSize children, the same number
+ *            as the generational GA.
+ *
+ * @t: Trial
+ * @gen: Number of the generation
+ *
+ * @Returns: Nothing
+ **/
+static void
+genSteady (genTrial *t,
+           int       gen)
+{
+  solveContext *ctx = t->ctx;
+  int           numSteps = (popSize + steadyOffspring-1) / steadyOffspring;
+  char        **childKey = t->childKey;
+  double       *childFit = t->childFit;
+
+  /* The second generation of the arena is free in steady-state trials */
+  for (int c = 0; c < steadyOffspring; c++) {
+    childKey[c] = t->arena[1-t->cur] + c * GENKEYSTRIDE;
+  }
+
+  for (int s = 0; s < numSteps; s++) {
+    int numSwaps = 0;
+
+    for (int c = 0; c < steadyOffspring; c++) {
+      int x = genSelect(&t->rng);
+      int y;
+
+      do {
+        y = genSelect(&t->rng);
+      } while (y == x);
+
+      numSwaps += genCrossover(ctx, t->popKey, t->popFit, x, y, childKey[c]);
+    }
+
+    g_atomic_int_add(&ctx->evalCount, numSwaps);
+
+    genEval(ctx, childKey, childFit, steadyOffspring, t->memo);
+    genMutate(ctx, childKey, childFit, steadyOffspring, &t->rng);
+
+    for (int c = 0; c < steadyOffspring; c++) {
+      genInsert(t->popKey, t->popFit, childKey[c], childFit[c]);
+    }
+
+    genBest(t, gen);
+
+    if (g_atomic_int_get(&ctx->cancel) == TRUE) {
+      break;
+    }
+  }
+}
+
+
+/**
+ * genInsert: Insert a key into a population sorted by descending fitness
+ *            in place of its least fit key, by binary search for its
+ *            rank. Keys of equal fitness keep their order. A key that is
+ *            no fitter than the least fit key, or is already in the
+ *            population, is not inserted.
+ *
+ * @key: Key to insert, copied into the space of the key it replaces
+ * @fit: Fitness of @key
+ *
+ * @Returns: TRUE if the key was inserted
+ **/
+static gboolean
+genInsert (char       **popKey,
+           double      *popFit,
+           const char  *key,
+           double       fit)
+{
+  int last = popSize-1;
+  int lo   = 0;
+  int hi   = last;
+
+  if (!(fit > popFit[last])) {
+    return FALSE;
+  }
+
+  /* Find the first key that is less fit */
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+
+    if (popFit[mid] >= fit) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  /* Copies of a key share its score up to the rounding of swap deltas,
+     so they can only rank close to the insertion point */
+  for (int i = lo-1; i >= 0 && popFit[i] - fit <= GENFITSLACK; i--) {
+    if (strcmp(popKey[i], key) == 0) {
+      return FALSE;
+    }
+  }
+
+  for (int i = lo; i <= last && fit - popFit[i] <= GENFITSLACK; i++) {
+    if (strcmp(popKey[i], key) == 0) {
+      return FALSE;
+    }
   }
 
-  g_free(popFit);
+  char *slot = popKey[last];
 
-  g_mutex_lock(updateBestMutex);
-  numLeft -= 1;
-  g_mutex_unlock(updateBestMutex);
+  strcpy(slot, key);
+
+  memmove(&popKey[lo+1], &popKey[lo], (last-lo) * sizeof(char *));
+  memmove(&popFit[lo+1], &popFit[lo], (last-lo) * sizeof(double));
+
+  popKey[lo] = slot;
+  popFit[lo] = fit;
+
+  return TRUE;
+}
+
+
+/**
+ * genBest: Publish the best key of a sorted population if it is a new
+ *          best of the trial, and note when the trial last improved
+ *
+ * @t: Trial
+ * @gen: Number of the current generation
+ *
+ * @Returns: Nothing
+ **/
+static void
+genBest (genTrial *t,
+         int       gen)
+{
+  char   **popKey = t->popKey;
+  double  *popFit = t->popFit;
+
+  /* Only a new best of this trial can be a new overall best */
+  if (popFit[0] > t->trialFit) {
+    t->trialFit = popFit[0];
+    cryptoPublish(t->ctx, popKey[0], popFit[0], t->trialNum, gen);
+  }
+
+  if (popFit[0] > t->runFit) {
+    t->runFit = popFit[0];
+    t->runGen = gen;
+  }
+}
+
+
+/**
+ * genTrialFit: Get the best score a GA trial has found
+ *
+ * @t: Trial
+ *
+ * @Returns: Best score, or -INFINITY before the first generation
+ **/
+double
+genTrialFit (genTrial *t)
+{
+  return t->trialFit;
+}
+
+
+/**
+ * genTrialFree: Add the fitness cache counts of a GA trial to the totals
+ *               of its solve, then free it
+ *
+ * @t: Trial
+ *
+ * @Returns: Nothing
+ **/
+void
+genTrialFree (genTrial *t)
+{
+  int hits;
+  int misses;
+
+  memoStats(t->memo, &hits, &misses);
+  g_atomic_int_add(&t->ctx->memoHits, hits);
+  g_atomic_int_add(&t->ctx->memoMisses, misses);
+
+  g_free(t->arenaBuf);
+  g_free(t->childKey);
+  g_free(t->childFit);
+  g_free(t->sortOrder);
+  g_free(t->sortKey);
+  g_free(t->sortFit);
+  g_free(t->popKey);
+  g_free(t->popFit);
+  memoFree(t->memo);
+  g_free(t);
 }
 
 
@@ -110,11 +475,22 @@ genSolve (gpointer trial,
  * @Returns: Nothing
  **/
 static void
-genInit (char **popKey, double *popFit)
+genInit (solveContext *ctx, char **popKey, double *popFit, rngState *rng,
+         fitMemo *memo)
 {  
   static char genVow[] = "aeiouyt";
   static char genKey[] = "aeiouytbcdfghjklmnpqrsvwxz";
 
+  int       numVowels = ctx->numVowels;
+  char     *vowels    = ctx->vowels;
+  gboolean *isVowel   = ctx->isVowel;
+
+  if (initMode == INITFREQ) {
+    genSeedFreq(ctx, popKey, rng);
+    genEval(ctx, popKey, popFit, popSize, memo);
+    return;
+  }
+
   for (int i = 0; i < popSize; i++) {
     memset(popKey[i], NUL, NUMSYMBOLS+1);
     
@@ -131,7 +507,7 @@ genInit (char **popKey, double *popFit)
       }
     }
 
-    int numSwaps = rand() % MAXSWAPS;
+    int numSwaps = rngInt(rng, MAXSWAPS);
 
     for (int j = 0; j < numSwaps; j++) {
       int x;
@@ -139,11 +515,11 @@ genInit (char **popKey, double *popFit)
 
       /* Mix up the consonants */
       do {
-        x = rand() % NUMSYMBOLS;
+        x = rngInt(rng, NUMSYMBOLS);
       } while (isVowel[x] == TRUE);
 
       do {
-        y = rand() % NUMSYMBOLS;
+        y = rngInt(rng, NUMSYMBOLS);
       } while (isVowel[y] == TRUE || y == x);
 
       char tmp = popKey[i][x];
@@ -151,17 +527,96 @@ genInit (char **popKey, double *popFit)
       popKey[i][y] = tmp;
 
       /* Mix up the vowels */
-      x = rand() % numVowels;
+      x = rngInt(rng, numVowels);
       do {
-        y = rand() % numVowels;
+        y = rngInt(rng, numVowels);
       } while (y == x);
 
       tmp = popKey[i][vowels[x]-'a'];
       popKey[i][vowels[x]-'a'] = popKey[i][vowels[y]-'a'];
       popKey[i][vowels[y]-'a'] = tmp;
     }
+  }
+
+  genEval(ctx, popKey, popFit, popSize, memo);
+}
+
+
+/**
+ * genSeedFreq: Generate an initial population around the key that maps
+ *              the ciphertext letters, in order of frequency, onto the
+ *              plaintext letters in order of unigram probability. Each
+ *              key but the first is perturbed by a few swaps of letters
+ *              at most SEEDSPREAD ranks apart, so the population stays
+ *              close to the estimate.
+ *
+ * @Returns: Nothing
+ **/
+static void
+genSeedFreq (solveContext *ctx, char **popKey, rngState *rng)
+{
+  double cipherWeight[NUMSYMBOLS];
+  int    cipherRank[NUMSYMBOLS];
+  int    plainRank[NUMSYMBOLS];
+  int    numLetters = 0;
+
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    cipherWeight[i] = ctx->freq[i];
+    numLetters += (ctx->freq[i] > 0);
+  }
+
+  genRank(cipherWeight, cipherRank);
+  genRank(unigramProb, plainRank);
+
+  for (int i = 0; i < popSize; i++) {
+    for (int r = 0; r < NUMSYMBOLS; r++) {
+      popKey[i][cipherRank[r]] = 'a' + plainRank[r];
+    }
+    popKey[i][NUMSYMBOLS] = NUL;
+
+    int numSwaps = (i == 0 || numLetters == 0) ? 0 : rngInt(rng, SEEDSWAPS+1);
+
+    for (int j = 0; j < numSwaps; j++) {
+      /* Swap the plaintext of a ciphertext letter with a nearby rank */
+      int r = rngInt(rng, numLetters);
+      int s = r + 1 + rngInt(rng, SEEDSPREAD);
 
-    popFit[i] = cryptoEval(popKey[i]);
+      if (s >= NUMSYMBOLS) {
+        s = r - 1 - rngInt(rng, SEEDSPREAD);
+      }
+
+      int  x = cipherRank[r];
+      int  y = cipherRank[MAX(s, 0)];
+      char tmp = popKey[i][x];
+
+      popKey[i][x] = popKey[i][y];
+      popKey[i][y] = tmp;
+    }
+  }
+}
+
+
+/**
+ * genRank: Order the letters by descending weight. Ties keep
+ *          alphabetical order.
+ *
+ * @weight: Weight of each letter
+ * @rank: Address where to store the letters, most weighty first
+ *
+ * @Returns: Nothing
+ **/
+static void
+genRank (const double *weight, int *rank)
+{
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    int n = i-1;
+
+    while (n >= 0 && weight[i] > weight[rank[n]]) {
+      rank[n+1] = rank[n];
+      n--;
+    }
+
+    rank[n+1] = i;
   }
 }
 
@@ -169,84 +624,219 @@ genInit (char **popKey, double *popFit)
 /**
  * genMate: Simulate mating process to generate next population of keys
  *
+ * @child: First key of the generation not in use, which receives the
+ *         children
+ *
  * @Returns: Nothing
  **/
 static void
-genMate (char **popKey, double *popFit)
+genMate (solveContext *ctx, char **popKey, double *popFit, char *child,
+         rngState *rng, fitMemo *memo)
 {
-  char childKey[popSize][NUMSYMBOLS+1];
-  
+  int       numTasks = (popSize + MATECHUNK-1) / MATECHUNK;
+  mateTask  task[numTasks];
+  workPool *pool = poolCurrent();
+  poolGroup group = { 0 };
+
+  for (int t = 0; t < numTasks; t++) {
+    task[t].ctx      = ctx;
+    task[t].popKey   = popKey;
+    task[t].popFit   = popFit;
+    task[t].child    = child;
+    task[t].first    = t * MATECHUNK;
+    task[t].last     = MIN((t+1) * MATECHUNK, popSize);
+
+    rngInit(&task[t].rng, rngNext(rng), t);
+  }
+
+  /* Queue all chunks but the first, which this thread breeds itself */
+  for (int t = 1; t < numTasks; t++) {
+    if (pool != NULL) {
+      poolPush(pool, genMateTask, &task[t], NULL, &group);
+    }
+  }
+
+  genMateTask(&task[0], NULL);
+
+  if (pool != NULL) {
+    poolJoin(pool, &group);
+  } else {
+    for (int t = 1; t < numTasks; t++) {
+      genMateTask(&task[t], NULL);
+    }
+  }
+
+  /* Replace parent population with child population */
   for (int i = 0; i < popSize; i++) {
+    popKey[i] = child + i * GENKEYSTRIDE;
+  }
+
+  genEval(ctx, popKey, popFit, popSize, memo);
+}
+
+
+/**
+ * genMateTask: Breed one chunk of the child generation
+ *
+ * @data: Mating task
+ *
+ * @Returns: Nothing
+ **/
+static void
+genMateTask (gpointer data,
+             gpointer udata)
+{
+  mateTask *task = data;
+  int       numSwaps = 0;
+
+  for (int i = task->first; i < task->last; i++) {
     /* Select two keys for mating */
     int x = i;
     int y;
 
     do {
-      y = genSelect();
+      y = genSelect(&task->rng);
     } while (y == x);
 
-    genCrossover(popKey, x, y, childKey[i]);
+    numSwaps += genCrossover(task->ctx, task->popKey, task->popFit, x, y,
+                             task->child + i * GENKEYSTRIDE);
   }
 
-  /* Replace parent population with child population */
-  for (int i = 0; i < popSize; i++) {
-    strcpy(popKey[i], childKey[i]);
-    popFit[i] = cryptoEval(popKey[i]);
+  g_atomic_int_add(&task->ctx->evalCount, numSwaps);
+}
+
+
+/**
+ * genEval: Score every key of a population. Keys found in the fitness
+ *          cache are not scored again; the others are scored together
+ *          with cryptoEvalBatch and added to the cache.
+ *
+ * @num: Number of keys
+ *
+ * @Returns: Nothing
+ **/
+static void
+genEval (solveContext *ctx, char **popKey, double *popFit, int num,
+         fitMemo *memo)
+{
+  char  **missKey = g_new(char *, num);
+  double *missFit = g_new(double, num);
+  int    *missIdx = g_new(int, num);
+  int     numMiss = 0;
+
+  for (int i = 0; i < num; i++) {
+    if (memoLookup(memo, popKey[i], &popFit[i]) == FALSE) {
+      missKey[numMiss] = popKey[i];
+      missIdx[numMiss] = i;
+      numMiss += 1;
+    }
+  }
+
+  cryptoEvalBatch(ctx, missKey, numMiss, missFit);
+
+  for (int m = 0; m < numMiss; m++) {
+    popFit[missIdx[m]] = missFit[m];
+    memoInsert(memo, missKey[m], missFit[m]);
+  }
+
+  g_free(missKey);
+  g_free(missFit);
+  g_free(missIdx);
+}
+
+
+/**
+ * genDiversity: Measure the diversity of a population as the percentage
+ *               of distinct scores. Copies of a key share its score, so
+ *               this approximates the share of distinct keys.
+ *
+ * @popFit: Fitness of each key, sorted
+ *
+ * @Returns: Percentage of distinct scores (1 ... 100)
+ **/
+static int
+genDiversity (double *popFit)
+{
+  int distinct = 1;
+
+  for (int i = 1; i < popSize; i++) {
+    if (popFit[i] != popFit[i-1]) {
+      distinct += 1;
+    }
   }
+
+  return distinct * 100 / popSize;
 }
 
 
 /**
  * genMutate: Mutate child generation of keys
  *
+ * @num: Number of keys
+ *
  * @Returns: Nothing
  **/
 static void
-genMutate (char **popKey, double *popFit)
+genMutate (solveContext *ctx, char **popKey, double *popFit, int num,
+           rngState *rng)
 {
-  for (int i = 0; i < popSize; i++) {
-    int z = rand() % 100;
+  int numSwaps = 0;
+
+  for (int i = 0; i < num; i++) {
+    int z = rngInt(rng, 100);
 
     if (z < muteRate) {
       int x;
       int y;
 
       do {
-        x = rand() % NUMSYMBOLS;
-      } while (freq[x] == 0);
+        x = rngInt(rng, NUMSYMBOLS);
+      } while (ctx->freq[x] == 0);
 
       do {
-        y = rand() % NUMSYMBOLS;
-      } while (y == x || freq[y] == 0);
+        y = rngInt(rng, NUMSYMBOLS);
+      } while (y == x || ctx->freq[y] == 0);
+
+      popFit[i] = cryptoEvalSwap(ctx, popKey[i], popFit[i], x, y);
+      numSwaps += 1;
       
       char tmp = popKey[i][x];
       popKey[i][x] = popKey[i][y];
       popKey[i][y] = tmp;
-
-      popFit[i] = cryptoEval(popKey[i]);
     }
   }
+
+  g_atomic_int_add(&ctx->evalCount, numSwaps);
 }
 
 
 /**
  * genSelect: Select a key for mating. Keys with higher fitness have a
- *            greater probability of being selected.
+ *            greater probability of being selected: the key of rank i
+ *            has weight popSize-i.
  *
  * @Returns: Index of key selected (0 ... POPSIZE-1)
  **/
 static int
-genSelect (void)
+genSelect (rngState *rng)
 {
-  int k = rand() % (popSize * (popSize+1) / 2);
-  int n = 0;
+  /* The product overflows an int, but the sum fits for MAXPOPSIZE keys */
+  gint64 total = (gint64) popSize * (popSize+1) / 2;
+  int    k     = rngInt(rng, total);
 
-  for (int i = 0; i < popSize; i++) {
-    n += popSize - i;
-    if (k < n) {
-      return i;
-    }
+  /* Counting from the least fit key, the first j+1 keys have a total
+     weight of (j+1)(j+2)/2; find the key whose weight covers m */
+  gint64 m = total - 1 - k;
+  gint64 j = (gint64) ((sqrt(8.0 * m + 1.0) - 1.0) / 2.0);
+
+  while ((j+1) * (j+2) / 2 <= m) {
+    j++;
   }
+  while (j > 0 && j * (j+1) / 2 > m) {
+    j--;
+  }
+
+  return popSize-1 - j;
 }
 
 
@@ -258,17 +848,20 @@ genSelect (void)
  * @y: Index of second parent key
  * @child1: Address where to store child key
  *
- * @Nothing
+ * @Returns: Number of swaps scored
  **/
-static void
-genCrossover (char **popKey,
-              int    x,
-              int    y,
-              char  *child)
+static int
+genCrossover (solveContext *ctx,
+              char        **popKey,
+              double       *popFit,
+              int           x,
+              int           y,
+              char         *child)
 {
   char testKey[NUMSYMBOLS+1];
   strcpy(testKey, popKey[x]);
-  double testFit = cryptoEval(testKey);
+  double testFit = popFit[x];
+  int  numSwaps = 0;
   char tmp;
   
   for (int i = 0; i < NUMSYMBOLS; i++) {
@@ -276,45 +869,73 @@ genCrossover (char **popKey,
     if (popKey[x][i] != popKey[y][i]) {
       int j;
       for (j = 0; popKey[x][j] != popKey[y][i]; j++);
-      tmp = testKey[i];
-      testKey[i] = testKey[j];
-      testKey[j] = tmp;
-      if (cryptoEval(testKey) < testFit) {
+      double swapFit = cryptoEvalSwapBounded(ctx, testKey, testFit, i, j,
+                                             testFit);
+      numSwaps += 1;
+      if (swapFit >= testFit) {
         tmp = testKey[i];
         testKey[i] = testKey[j];
         testKey[j] = tmp;
-      } else {
-        testFit = cryptoEval(testKey);
+        testFit = swapFit;
       }
     }
   }
   strcpy(child, testKey);
+
+  return numSwaps;
 }
 
 
 /**
- * genSort: Sort population in order of descending fitness. Uses insertion
- *          sort algorithm.
+ * genSort: Sort population in order of descending fitness. Sorts a
+ *          permutation of the population with a bottom-up merge sort,
+ *          then applies it to the key pointers and fitness values. Keys
+ *          of equal fitness keep their order.
+ *
+ * @t: Trial whose population to sort
  *
  * @Returns: Nothing
  **/
 static void
-genSort (char   **popKey,
-         double  *popFit)
+genSort (genTrial *t)
 {
-	for (int k = 1; k < popSize; k++) {
-		int n = k-1;
-		
-		char  *key = popKey[k];
-		double fit = popFit[k];
+  char  **popKey  = t->popKey;
+  double *popFit  = t->popFit;
+  int    *order   = t->sortOrder;
+  int    *merge   = t->sortOrder + popSize;
+  char  **sortKey = t->sortKey;
+  double *sortFit = t->sortFit;
 
-		while ((n >= 0) && (fit > popFit[n])) {
-		  popKey[n+1] = popKey[n];
-		  popFit[n+1] = popFit[n];
-		  n--;
-		}
+  for (int i = 0; i < popSize; i++) {
+    order[i] = i;
+  }
 
-	  popKey[n+1] = key;
-		popFit[n+1] = fit;
+  for (int width = 1; width < popSize; width *= 2) {
+    for (int lo = 0; lo < popSize; lo += 2 * width) {
+      int mid = MIN(lo + width, popSize);
+      int hi  = MIN(lo + 2 * width, popSize);
+      int a   = lo;
+      int b   = mid;
+
+      for (int k = lo; k < hi; k++) {
+        if (b == hi || (a < mid && popFit[order[a]] >= popFit[order[b]])) {
+          merge[k] = order[a++];
+        } else {
+          merge[k] = order[b++];
+        }
+      }
+    }
+
+    int *tmp = order;
+    order = merge;
+    merge = tmp;
   }
+
+  for (int i = 0; i < popSize; i++) {
+    sortKey[i] = popKey[order[i]];
+    sortFit[i] = popFit[order[i]];
+  }
+
+  memcpy(popKey, sortKey, popSize * sizeof(char *));
+  memcpy(popFit, sortFit, popSize * sizeof(double));
 }
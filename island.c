@@ -0,0 +1,234 @@
+/*
+ * island.c
+ * Copyright (C) Jacob Gajek 2010 <jgajek@gmail.com>
+ *
+ * Alkindus is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alkindus is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "solve.h"
+
+
+/*
+ * In the island model, the trials running at the same time periodically
+ * send copies of their best keys to each other. A trial claims a free
+ * island with islandClaim when it starts running and releases it when
+ * it stops, so no two running trials ever share an island, however the
+ * pool orders them and however racing sets them aside.
+ *
+ * Every island has one mailbox slot per island that may send to it. A
+ * slot has a single writer and a single reader, and holds a pointer to
+ * the latest packet of migrants, which is swapped in and out atomically.
+ * An unread packet is replaced by a newer one, so a slow island simply
+ * skips old migrants and no trial ever waits for another.
+ */
+struct s_migrantPack {
+  int    count;
+  double fit[MAXMIGRANTS];
+  char   key[MAXMIGRANTS][NUMSYMBOLS+1];
+};
+
+typedef struct s_migrantPack migrantPack;
+
+static migrantPack *islandSwap (solveContext *ctx, int dst, int src,
+                                migrantPack *pack);
+
+
+/**
+ * islandInit: Create the mailboxes of the island model, numIslands x
+ *             numIslands slots
+ *
+ * @islands: Number of islands
+ *
+ * @Returns: Nothing
+ **/
+void
+islandInit (solveContext *ctx,
+            int           islands)
+{
+  ctx->numIslands = MAX(islands, 1);
+  ctx->mailbox    = g_new0(gpointer, ctx->numIslands * ctx->numIslands);
+  ctx->islandBusy = g_new0(gint, ctx->numIslands);
+}
+
+
+/**
+ * islandFree: Free the mailboxes and any migrants left in them
+ *
+ * @Returns: Nothing
+ **/
+void
+islandFree (solveContext *ctx)
+{
+  for (int i = 0; i < ctx->numIslands * ctx->numIslands; i++) {
+    g_free(ctx->mailbox[i]);
+  }
+
+  g_free(ctx->mailbox);
+  g_free((gpointer) ctx->islandBusy);
+  ctx->mailbox    = NULL;
+  ctx->islandBusy = NULL;
+}
+
+
+/**
+ * islandClaim: Claim a free island for a trial that starts running
+ *
+ * @Returns: Number of the island, or -1 if all are taken
+ **/
+int
+islandClaim (solveContext *ctx)
+{
+  for (int i = 0; i < ctx->numIslands; i++) {
+    if (g_atomic_int_compare_and_exchange(&ctx->islandBusy[i], FALSE, TRUE)) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+
+/**
+ * islandRelease: Release the island of a trial that stops running.
+ *                Migrants still in its mailboxes go to the next trial
+ *                to claim it.
+ *
+ * @island: Number of the island
+ *
+ * @Returns: Nothing
+ **/
+void
+islandRelease (solveContext *ctx,
+               int           island)
+{
+  g_atomic_int_set(&ctx->islandBusy[island], FALSE);
+}
+
+
+/**
+ * islandSend: Send copies of the best keys of a population to the
+ *             neighbouring islands
+ *
+ * @island: Island of the sending trial
+ * @popKey: Population sorted by descending fitness
+ * @popFit: Fitness of each key
+ *
+ * @Returns: Nothing
+ **/
+void
+islandSend (solveContext *ctx,
+            int           island,
+            char        **popKey,
+            double       *popFit)
+{
+  int numIslands = ctx->numIslands;
+  int src        = island;
+  int count      = MIN(numMigrants, popSize);
+
+  for (int d = 1; d < numIslands; d++) {
+    int dst = (src + d) % numIslands;
+
+    if (islandTopology == TOPORING && d > 1) {
+      break;
+    }
+
+    migrantPack *pack = g_new(migrantPack, 1);
+
+    pack->count = count;
+
+    for (int i = 0; i < count; i++) {
+      strcpy(pack->key[i], popKey[i]);
+      pack->fit[i] = popFit[i];
+    }
+
+    g_free(islandSwap(ctx, dst, src, pack));
+  }
+}
+
+
+/**
+ * islandReceive: Replace the worst keys of a population with any migrants
+ *                waiting in the mailboxes of an island. The population
+ *                must be sorted again afterwards.
+ *
+ * @island: Island of the receiving trial
+ * @popKey: Population sorted by descending fitness
+ * @popFit: Fitness of each key
+ *
+ * @Returns: Number of keys replaced
+ **/
+int
+islandReceive (solveContext *ctx,
+               int           island,
+               char        **popKey,
+               double       *popFit)
+{
+  int numIslands = ctx->numIslands;
+  int dst        = island;
+  int next       = popSize-1;
+
+  for (int src = 0; src < numIslands; src++) {
+    if (src == dst) {
+      continue;
+    }
+
+    migrantPack *pack = islandSwap(ctx, dst, src, NULL);
+
+    if (pack == NULL) {
+      continue;
+    }
+
+    for (int i = 0; i < pack->count && next > 0; i++) {
+      /* Migrants never displace a better resident */
+      if (pack->fit[i] > popFit[next]) {
+        strcpy(popKey[next], pack->key[i]);
+        popFit[next] = pack->fit[i];
+        next -= 1;
+      }
+    }
+
+    g_free(pack);
+  }
+
+  return popSize-1 - next;
+}
+
+
+/**
+ * islandSwap: Atomically replace the packet in a mailbox slot
+ *
+ * @dst: Receiving island
+ * @src: Sending island
+ * @pack: New packet, or NULL to take the packet out
+ *
+ * @Returns: Previous packet, or NULL if the slot was empty
+ **/
+static migrantPack *
+islandSwap (solveContext *ctx,
+            int           dst,
+            int           src,
+            migrantPack  *pack)
+{
+  gpointer *slot = &ctx->mailbox[dst * ctx->numIslands + src];
+  gpointer  old;
+
+  do {
+    old = g_atomic_pointer_get(slot);
+  } while (!g_atomic_pointer_compare_and_exchange(slot, old, pack));
+
+  return old;
+}
@@ -0,0 +1,886 @@
+/*
+ * kernel.c
+ * Copyright (C) Jacob Gajek 2010 <jgajek@gmail.com>
+ *
+ * Alkindus is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alkindus is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELX86
+#include <immintrin.h>
+#endif
+
+#include "solve.h"
+
+#define CHECKLEN    4099    // Length of random text used by kernelCheck
+#define CHECKKEYS   32      // Number of random keys used by kernelCheck
+
+
+/*
+ * Scoring kernels evaluate a ciphertext of symbol indices (0..25) under a
+ * key mapping cipher symbols to plaintext symbols, using the dense score
+ * tables. Every kernel keeps KERNELLANES partial sums, adding the score of
+ * the n-gram window j to sum j % KERNELLANES, and combines them with
+ * kernelReduce. The vectorized kernels therefore return bit-for-bit the
+ * same scores as the scalar kernel.
+ *
+ * Each kernel is written once as an inline function taking the n-gram
+ * length as its last parameter. KERNELINSTANCE instantiates it for every
+ * length kept in dense tables, so that the compiler sees constant trip
+ * counts and index multipliers in the hot loops. Other lengths use the
+ * generic instances, which read the length from the model.
+ */
+#define KERNELINLINE static inline __attribute__((always_inline))
+
+typedef void (*batchFunc) (const kernelModel *model,
+                           const guint8      *text,
+                           int                len,
+                           const guint8      *keys,
+                           int                nkeys,
+                           double            *scores);
+
+/*
+ * The kernel instances for one n-gram length
+ */
+struct s_kernelSet {
+  kernelFunc scalar;
+  batchFunc  batchScalar;
+#ifdef KERNELX86
+  kernelFunc avx2;
+  kernelFunc avx512;
+  batchFunc  batchAvx2;
+#endif
+};
+
+typedef struct s_kernelSet kernelSet;
+
+/*
+ * State of every key scored by a batch kernel: rolling window index,
+ * prior index, and partial sums stored lane-major so that the sums of
+ * consecutive keys are adjacent.
+ */
+struct s_batchState {
+  guint  index[KERNELBATCH];
+  guint  prior[KERNELBATCH];
+  double acc[KERNELLANES][KERNELBATCH];
+  gint64 sum[KERNELBATCH];
+};
+
+typedef struct s_batchState batchState;
+
+static gboolean kernelCheck      (kernelFunc kernel, const kernelModel *model);
+static gboolean kernelBatchCheck (batchFunc kernel, const kernelModel *model);
+
+static const kernelSet *kernelCurrent (const kernelModel *model);
+
+
+static batchFunc batchKernel;
+
+
+/**
+ * kernelSpan: Compute 26^(n-1), the number of (n-1)-grams
+ *
+ * @Returns: Size of the prior table
+ **/
+KERNELINLINE guint
+kernelSpan (const int n)
+{
+  guint span = 1;
+
+  for (int k = 0; k < n-1; k++) {
+    span *= NUMSYMBOLS;
+  }
+
+  return span;
+}
+
+
+/**
+ * kernelReduce: Combine the partial sums of a scoring kernel
+ *
+ * @acc: KERNELLANES partial sums
+ * @prior: Prior score of the leading (n-1)-gram
+ *
+ * @Returns: Total score
+ **/
+double
+kernelReduce (const double *acc,
+              double        prior)
+{
+  return prior + (((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+                  ((acc[4] + acc[5]) + (acc[6] + acc[7])));
+}
+
+
+/**
+ * kernelFinish: Score the n-gram windows ending at positions @start and
+ *               above one at a time, then add the prior score and combine
+ *               the partial sums
+ *
+ * @start: End position of the first window to score
+ * @acc: Partial sums of the windows before @start (double tables)
+ * @sum: Sum of the windows before @start (quantized tables)
+ * @n: N-gram length
+ *
+ * @Returns: Score of the decrypted text
+ **/
+KERNELINLINE double
+kernelFinish (const kernelModel *model,
+              const guint8      *text,
+              int                len,
+              const guint8      *key,
+              int                start,
+              double            *acc,
+              gint64             sum,
+              const int          n)
+{
+  guint span  = kernelSpan(n);
+  guint index = 0;
+
+  for (int k = start-n+1; k < start; k++) {
+    index = index * NUMSYMBOLS + key[text[k]];
+  }
+
+  if (model->cond16 != NULL) {
+    for (int i = start; i < len; i++) {
+      index = index * NUMSYMBOLS + key[text[i]];
+      sum += model->cond16[index];
+      index %= span;
+    }
+  } else {
+    for (int i = start, j = start-n+1; i < len; i++, j++) {
+      index = index * NUMSYMBOLS + key[text[i]];
+      acc[j % KERNELLANES] += model->cond[index];
+      index %= span;
+    }
+  }
+
+  index = 0;
+
+  for (int k = 0; k < n-1; k++) {
+    index = index * NUMSYMBOLS + key[text[k]];
+  }
+
+  if (model->cond16 != NULL) {
+    return (sum + model->prior16[index]) * model->scale;
+  } else {
+    return kernelReduce(acc, model->prior[index]);
+  }
+}
+
+
+/**
+ * kernelScalar: Portable scoring kernel
+ *
+ * @Returns: Score of the decrypted text
+ **/
+KERNELINLINE double
+kernelScalar (const kernelModel *model,
+              const guint8      *text,
+              int                len,
+              const guint8      *key,
+              const int          n)
+{
+  double acc[KERNELLANES] = { 0.0 };
+
+  return kernelFinish(model, text, len, key, n-1, acc, 0, n);
+}
+
+
+/**
+ * kernelBatchStart: Compute the index of the leading (n-1)-gram under
+ *                   every key, which is both its prior index and the
+ *                   starting state of the rolling window index
+ *
+ * @Returns: Nothing
+ **/
+KERNELINLINE void
+kernelBatchStart (batchState        *state,
+                  const guint8      *text,
+                  const guint8      *keys,
+                  int                nkeys,
+                  const int          n)
+{
+  memset(state, 0, sizeof(batchState));
+
+  for (int i = 0; i < n-1; i++) {
+    const guint8 *map = &keys[text[i] * KERNELBATCH];
+
+    for (int k = 0; k < nkeys; k++) {
+      state->index[k] = state->index[k] * NUMSYMBOLS + map[k];
+    }
+  }
+
+  memcpy(state->prior, state->index, sizeof(state->prior));
+}
+
+
+/**
+ * kernelBatchPart: Score keys @first .. @nkeys-1 one at a time. The window
+ *                  index rolls forward by multiplying by 26, adding the
+ *                  new symbol and subtracting the oldest symbol times
+ *                  26^(n-1), as the vectorized kernel does.
+ *
+ * @Returns: Nothing
+ **/
+KERNELINLINE void
+kernelBatchPart (batchState        *state,
+                 const kernelModel *model,
+                 const guint8      *text,
+                 int                len,
+                 const guint8      *keys,
+                 int                first,
+                 int                nkeys,
+                 const int          n)
+{
+  guint top = kernelSpan(n);
+
+  for (int i = n-1, j = 0; i < len; i++, j++) {
+    const guint8 *map = &keys[text[i] * KERNELBATCH];
+    const guint8 *old = &keys[text[i-n+1] * KERNELBATCH];
+    int lane = j % KERNELLANES;
+
+    for (int k = first; k < nkeys; k++) {
+      guint index = state->index[k] * NUMSYMBOLS + map[k];
+
+      if (model->cond16 != NULL) {
+        state->sum[k] += model->cond16[index];
+      } else {
+        state->acc[lane][k] += model->cond[index];
+      }
+
+      state->index[k] = index - old[k] * top;
+    }
+  }
+}
+
+
+/**
+ * kernelBatchDone: Add the prior scores and combine the partial sums of
+ *                  every key
+ *
+ * @Returns: Nothing
+ **/
+static void
+kernelBatchDone (batchState        *state,
+                 const kernelModel *model,
+                 int                nkeys,
+                 double            *scores)
+{
+  for (int k = 0; k < nkeys; k++) {
+    if (model->cond16 != NULL) {
+      scores[k] = (state->sum[k] + model->prior16[state->prior[k]]) *
+                  model->scale;
+    } else {
+      double acc[KERNELLANES];
+
+      for (int l = 0; l < KERNELLANES; l++) {
+        acc[l] = state->acc[l][k];
+      }
+
+      scores[k] = kernelReduce(acc, model->prior[state->prior[k]]);
+    }
+  }
+}
+
+
+/**
+ * kernelBatchScalar: Portable batch scoring kernel
+ *
+ * @Returns: Nothing
+ **/
+KERNELINLINE void
+kernelBatchScalar (const kernelModel *model,
+                   const guint8      *text,
+                   int                len,
+                   const guint8      *keys,
+                   int                nkeys,
+                   double            *scores,
+                   const int          n)
+{
+  batchState state;
+
+  kernelBatchStart(&state, text, keys, nkeys, n);
+  kernelBatchPart(&state, model, text, len, keys, 0, nkeys, n);
+  kernelBatchDone(&state, model, nkeys, scores);
+}
+
+
+#ifdef KERNELX86
+
+/**
+ * kernelIndexAvx2: Compute the table indices of the eight n-gram windows
+ *                  ending at positions @end .. @end+7
+ *
+ * @Returns: Vector of eight indices
+ **/
+__attribute__((target("avx2")))
+KERNELINLINE __m256i
+kernelIndexAvx2 (const guint8 *text,
+                 int           end,
+                 __m128i       keyLo,
+                 __m128i       keyHi,
+                 const int     n)
+{
+  const __m128i sixteen = _mm_set1_epi8(16);
+  const __m128i fifteen = _mm_set1_epi8(15);
+  const __m256i radix   = _mm256_set1_epi32(NUMSYMBOLS);
+
+  __m256i index = _mm256_setzero_si256();
+
+  for (int k = 0; k < n; k++) {
+    __m128i c  = _mm_loadl_epi64((const __m128i *) &text[end-n+1+k]);
+
+    /* Apply the key: look up symbols 0..15 and 16..25 separately */
+    __m128i lo = _mm_shuffle_epi8(keyLo, c);
+    __m128i hi = _mm_shuffle_epi8(keyHi, _mm_sub_epi8(c, sixteen));
+    __m128i m  = _mm_blendv_epi8(lo, hi, _mm_cmpgt_epi8(c, fifteen));
+
+    index = _mm256_add_epi32(_mm256_mullo_epi32(index, radix),
+                             _mm256_cvtepu8_epi32(m));
+  }
+
+  return index;
+}
+
+
+/**
+ * kernelGather16: Gather and sign-extend eight 16-bit table entries, and
+ *                 add them to four 64-bit sums
+ *
+ * @Returns: Updated sums
+ **/
+__attribute__((target("avx2")))
+KERNELINLINE __m256i
+kernelGather16 (const gint16 *table,
+                __m256i       index,
+                __m256i       sum)
+{
+  /* Tables are padded by one entry, so the 32-bit loads stay in bounds */
+  __m256i v = _mm256_i32gather_epi32((const int *) table, index, 2);
+
+  v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+
+  sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(
+                                _mm256_castsi256_si128(v)));
+  sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(
+                                _mm256_extracti128_si256(v, 1)));
+  return sum;
+}
+
+
+/**
+ * kernelAvx2: Scoring kernel using AVX2 byte shuffles and gathers
+ *
+ * @Returns: Score of the decrypted text
+ **/
+__attribute__((target("avx2")))
+KERNELINLINE double
+kernelAvx2 (const kernelModel *model,
+            const guint8      *text,
+            int                len,
+            const guint8      *key,
+            const int          n)
+{
+  int i = n-1;
+
+  __m128i keyLo = _mm_loadu_si128((const __m128i *) key);
+  __m128i keyHi = _mm_loadu_si128((const __m128i *) (key + 16));
+
+  double acc[KERNELLANES];
+  gint64 part[4];
+
+  if (model->cond16 != NULL) {
+    __m256i sum = _mm256_setzero_si256();
+
+    for (; i + KERNELLANES <= len; i += KERNELLANES) {
+      __m256i index = kernelIndexAvx2(text, i, keyLo, keyHi, n);
+      sum = kernelGather16(model->cond16, index, sum);
+    }
+
+    _mm256_storeu_si256((__m256i *) part, sum);
+    memset(acc, 0, sizeof(acc));
+
+    return kernelFinish(model, text, len, key, i, acc,
+                        part[0] + part[1] + part[2] + part[3], n);
+  }
+
+  __m256d accLo = _mm256_setzero_pd();
+  __m256d accHi = _mm256_setzero_pd();
+
+  for (; i + KERNELLANES <= len; i += KERNELLANES) {
+    __m256i index = kernelIndexAvx2(text, i, keyLo, keyHi, n);
+
+    accLo = _mm256_add_pd(accLo, _mm256_i32gather_pd(
+              model->cond, _mm256_castsi256_si128(index), 8));
+    accHi = _mm256_add_pd(accHi, _mm256_i32gather_pd(
+              model->cond, _mm256_extracti128_si256(index, 1), 8));
+  }
+
+  _mm256_storeu_pd(&acc[0], accLo);
+  _mm256_storeu_pd(&acc[4], accHi);
+
+  return kernelFinish(model, text, len, key, i, acc, 0, n);
+}
+
+
+/**
+ * kernelAvx512: Scoring kernel computing sixteen window indices at a time
+ *               with AVX-512 and gathering eight doubles per instruction
+ *
+ * @Returns: Score of the decrypted text
+ **/
+__attribute__((target("avx512f,avx2")))
+KERNELINLINE double
+kernelAvx512 (const kernelModel *model,
+              const guint8      *text,
+              int                len,
+              const guint8      *key,
+              const int          n)
+{
+  if (model->cond16 != NULL) {
+    return kernelAvx2(model, text, len, key, n);
+  }
+
+  const __m128i sixteen = _mm_set1_epi8(16);
+  const __m128i fifteen = _mm_set1_epi8(15);
+  const __m512i radix   = _mm512_set1_epi32(NUMSYMBOLS);
+
+  int i = n-1;
+
+  __m128i keyLo = _mm_loadu_si128((const __m128i *) key);
+  __m128i keyHi = _mm_loadu_si128((const __m128i *) (key + 16));
+  __m512d sum   = _mm512_setzero_pd();
+
+  double acc[KERNELLANES];
+
+  for (; i + 2*KERNELLANES <= len; i += 2*KERNELLANES) {
+    __m512i index = _mm512_setzero_si512();
+
+    for (int k = 0; k < n; k++) {
+      __m128i c  = _mm_loadu_si128((const __m128i *) &text[i-n+1+k]);
+      __m128i lo = _mm_shuffle_epi8(keyLo, c);
+      __m128i hi = _mm_shuffle_epi8(keyHi, _mm_sub_epi8(c, sixteen));
+      __m128i m  = _mm_blendv_epi8(lo, hi, _mm_cmpgt_epi8(c, fifteen));
+
+      index = _mm512_add_epi32(_mm512_mullo_epi32(index, radix),
+                               _mm512_cvtepu8_epi32(m));
+    }
+
+    /* Add the two halves in window order to keep the lane sums exact */
+    sum = _mm512_add_pd(sum, _mm512_i32gather_pd(
+            _mm512_castsi512_si256(index), model->cond, 8));
+    sum = _mm512_add_pd(sum, _mm512_i32gather_pd(
+            _mm512_extracti64x4_epi64(index, 1), model->cond, 8));
+  }
+
+  if (i + KERNELLANES <= len) {
+    __m256i index = kernelIndexAvx2(text, i, keyLo, keyHi, n);
+    sum = _mm512_add_pd(sum, _mm512_i32gather_pd(index, model->cond, 8));
+    i += KERNELLANES;
+  }
+
+  _mm512_storeu_pd(acc, sum);
+
+  return kernelFinish(model, text, len, key, i, acc, 0, n);
+}
+
+
+/**
+ * kernelBatchAvx2: Batch scoring kernel handling eight keys per vector.
+ *                  Any keys left over are scored by kernelBatchPart.
+ *
+ * @Returns: Nothing
+ **/
+__attribute__((target("avx2")))
+KERNELINLINE void
+kernelBatchAvx2 (const kernelModel *model,
+                 const guint8      *text,
+                 int                len,
+                 const guint8      *keys,
+                 int                nkeys,
+                 double            *scores,
+                 const int          n)
+{
+  const __m256i radix = _mm256_set1_epi32(NUMSYMBOLS);
+  const __m256i top   = _mm256_set1_epi32(kernelSpan(n));
+
+  int vkeys = nkeys - nkeys % 8;
+
+  batchState state;
+
+  kernelBatchStart(&state, text, keys, nkeys, n);
+
+  for (int i = n-1, j = 0; i < len; i++, j++) {
+    const guint8 *map = &keys[text[i] * KERNELBATCH];
+    const guint8 *old = &keys[text[i-n+1] * KERNELBATCH];
+    double *acc = state.acc[j % KERNELLANES];
+
+    for (int k = 0; k < vkeys; k += 8) {
+      __m256i roll  = _mm256_loadu_si256((const __m256i *) &state.index[k]);
+      __m256i m     = _mm256_cvtepu8_epi32(
+                        _mm_loadl_epi64((const __m128i *) &map[k]));
+      __m256i mo    = _mm256_cvtepu8_epi32(
+                        _mm_loadl_epi64((const __m128i *) &old[k]));
+      __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(roll, radix), m);
+
+      _mm256_storeu_si256((__m256i *) &state.index[k],
+                          _mm256_sub_epi32(index,
+                                           _mm256_mullo_epi32(mo, top)));
+
+      if (model->cond16 != NULL) {
+        __m256i sum[2];
+
+        sum[0] = _mm256_loadu_si256((const __m256i *) &state.sum[k]);
+        sum[1] = _mm256_loadu_si256((const __m256i *) &state.sum[k+4]);
+
+        __m256i v = _mm256_i32gather_epi32((const int *) model->cond16,
+                                           index, 2);
+        v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+
+        sum[0] = _mm256_add_epi64(sum[0], _mm256_cvtepi32_epi64(
+                                            _mm256_castsi256_si128(v)));
+        sum[1] = _mm256_add_epi64(sum[1], _mm256_cvtepi32_epi64(
+                                            _mm256_extracti128_si256(v, 1)));
+
+        _mm256_storeu_si256((__m256i *) &state.sum[k], sum[0]);
+        _mm256_storeu_si256((__m256i *) &state.sum[k+4], sum[1]);
+      } else {
+        __m256d lo = _mm256_i32gather_pd(model->cond,
+                                         _mm256_castsi256_si128(index), 8);
+        __m256d hi = _mm256_i32gather_pd(model->cond,
+                                         _mm256_extracti128_si256(index, 1),
+                                         8);
+
+        _mm256_storeu_pd(&acc[k], _mm256_add_pd(_mm256_loadu_pd(&acc[k]),
+                                                lo));
+        _mm256_storeu_pd(&acc[k+4], _mm256_add_pd(_mm256_loadu_pd(&acc[k+4]),
+                                                  hi));
+      }
+    }
+  }
+
+  if (vkeys < nkeys) {
+    kernelBatchPart(&state, model, text, len, keys, vkeys, nkeys, n);
+  }
+
+  kernelBatchDone(&state, model, nkeys, scores);
+}
+
+#endif /* KERNELX86 */
+
+
+/*
+ * KERNELINSTANCE(name, n) defines kernel instances name##Scalar and so on,
+ * with the n-gram length fixed to the expression n.
+ */
+#define KERNELPORTABLE(name, n)                                             \
+static double                                                               \
+name##Scalar (const kernelModel *model, const guint8 *text, int len,       \
+              const guint8 *key)                                            \
+{                                                                           \
+  return kernelScalar(model, text, len, key, n);                            \
+}                                                                           \
+                                                                            \
+static void                                                                 \
+name##BatchScalar (const kernelModel *model, const guint8 *text, int len,  \
+                   const guint8 *keys, int nkeys, double *scores)           \
+{                                                                           \
+  kernelBatchScalar(model, text, len, keys, nkeys, scores, n);              \
+}
+
+#ifdef KERNELX86
+#define KERNELINSTANCE(name, n)                                             \
+KERNELPORTABLE(name, n)                                                     \
+                                                                            \
+__attribute__((target("avx2")))                                             \
+static double                                                               \
+name##Avx2 (const kernelModel *model, const guint8 *text, int len,         \
+            const guint8 *key)                                              \
+{                                                                           \
+  return kernelAvx2(model, text, len, key, n);                              \
+}                                                                           \
+                                                                            \
+__attribute__((target("avx512f,avx2")))                                     \
+static double                                                               \
+name##Avx512 (const kernelModel *model, const guint8 *text, int len,       \
+              const guint8 *key)                                            \
+{                                                                           \
+  return kernelAvx512(model, text, len, key, n);                            \
+}                                                                           \
+                                                                            \
+__attribute__((target("avx2")))                                             \
+static void                                                                 \
+name##BatchAvx2 (const kernelModel *model, const guint8 *text, int len,    \
+                 const guint8 *keys, int nkeys, double *scores)             \
+{                                                                           \
+  kernelBatchAvx2(model, text, len, keys, nkeys, scores, n);                \
+}
+
+#define KERNELSET(name) \
+  { name##Scalar, name##BatchScalar, name##Avx2, name##Avx512, name##BatchAvx2 }
+#else
+#define KERNELINSTANCE(name, n) KERNELPORTABLE(name, n)
+
+#define KERNELSET(name) { name##Scalar, name##BatchScalar }
+#endif
+
+KERNELINSTANCE(kernelAny, model->ngramLen)
+KERNELINSTANCE(kernel2, 2)
+KERNELINSTANCE(kernel3, 3)
+KERNELINSTANCE(kernel4, 4)
+KERNELINSTANCE(kernel5, 5)
+
+static const kernelSet kernelSets[MAXDENSELEN+1] = {
+  [2] = KERNELSET(kernel2),
+  [3] = KERNELSET(kernel3),
+  [4] = KERNELSET(kernel4),
+  [5] = KERNELSET(kernel5)
+};
+
+static const kernelSet kernelGeneric = KERNELSET(kernelAny);
+
+static const kernelSet *kernelUse = &kernelGeneric;
+
+
+/**
+ * kernelSpecialize: Choose the kernel instances compiled for an n-gram
+ *                   length. Called once, before any kernel is selected.
+ *
+ * @n: N-gram length
+ *
+ * @Returns: Nothing
+ **/
+void
+kernelSpecialize (int n)
+{
+  if (n >= 0 && n <= MAXDENSELEN && kernelSets[n].scalar != NULL) {
+    kernelUse = &kernelSets[n];
+  } else {
+    kernelUse = &kernelGeneric;
+  }
+}
+
+
+/**
+ * kernelCurrent: Get the kernel instances matching the n-gram length of
+ *                a model
+ *
+ * @Returns: Kernel instances
+ **/
+static const kernelSet *
+kernelCurrent (const kernelModel *model)
+{
+  int n = model->ngramLen;
+
+  if (n >= 0 && n <= MAXDENSELEN && kernelUse == &kernelSets[n]) {
+    return kernelUse;
+  }
+
+  return &kernelGeneric;
+}
+
+
+/**
+ * kernelSelect: Choose the fastest scoring kernel supported by the CPU,
+ *               and the matching batch kernel used by kernelBatch. A
+ *               vectorized kernel is only used if it agrees bit for bit
+ *               with the scalar kernel on random input.
+ *
+ * @model: Dense score tables
+ * @name: Address where to store the name of the kernel
+ *
+ * @Returns: Scoring kernel
+ **/
+kernelFunc
+kernelSelect (const kernelModel  *model,
+              const char        **name)
+{
+  const kernelSet *set = kernelCurrent(model);
+
+  batchKernel = set->batchScalar;
+
+#ifdef KERNELX86
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2") &&
+      kernelBatchCheck(set->batchAvx2, model) == TRUE) {
+    batchKernel = set->batchAvx2;
+  }
+
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") &&
+      kernelCheck(set->avx512, model) == TRUE) {
+    *name = "avx512";
+    return set->avx512;
+  }
+
+  if (__builtin_cpu_supports("avx2") &&
+      kernelCheck(set->avx2, model) == TRUE) {
+    *name = "avx2";
+    return set->avx2;
+  }
+#endif
+
+  *name = "scalar";
+  return set->scalar;
+}
+
+
+/**
+ * kernelBatch: Score up to KERNELBATCH keys in a single pass over the text.
+ *              The keys are stored structure-of-arrays: the plaintext
+ *              symbol for cipher symbol c under key k is at
+ *              keys[c*KERNELBATCH+k]. Each score agrees bit for bit with
+ *              the single key kernels.
+ *
+ * @model: Dense score tables
+ * @text: Ciphertext symbols
+ * @len: Length of text
+ * @keys: Keys to evaluate
+ * @nkeys: Number of keys
+ * @scores: Address where to store the scores
+ *
+ * @Returns: Nothing
+ **/
+void
+kernelBatch (const kernelModel *model,
+             const guint8      *text,
+             int                len,
+             const guint8      *keys,
+             int                nkeys,
+             double            *scores)
+{
+  g_assert(nkeys <= KERNELBATCH);
+
+  batchKernel(model, text, len, keys, nkeys, scores);
+}
+
+
+/**
+ * kernelCheck: Compare a scoring kernel with the generic scalar kernel on
+ *              random text and keys
+ *
+ * @Returns: FALSE if any score differs in any bit
+ **/
+static gboolean
+kernelCheck (kernelFunc         kernel,
+             const kernelModel *model)
+{
+  guint8  text[CHECKLEN];
+  guint8  key[KERNELKEYLEN];
+  guint32 seed = 12345;
+
+  for (int i = 0; i < CHECKLEN; i++) {
+    seed = seed * 1103515245 + 12345;
+    text[i] = (seed >> 16) % NUMSYMBOLS;
+  }
+
+  memset(key, 0, KERNELKEYLEN);
+
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    key[i] = i;
+  }
+
+  for (int k = 0; k < CHECKKEYS; k++) {
+    for (int i = NUMSYMBOLS-1; i > 0; i--) {
+      seed = seed * 1103515245 + 12345;
+
+      int    j = (seed >> 16) % (i+1);
+      guint8 tmp = key[i];
+
+      key[i] = key[j];
+      key[j] = tmp;
+    }
+
+    /* Vary the length to exercise every tail */
+    int len = CHECKLEN - k % (2*KERNELLANES);
+
+    double want = kernelAnyScalar(model, text, len, key);
+    double got  = kernel(model, text, len, key);
+
+    if (memcmp(&want, &got, sizeof(double)) != 0) {
+      g_warning("Scoring kernel disagrees with generic scalar kernel\n");
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+
+/**
+ * kernelBatchCheck: Compare a batch scoring kernel with the generic scalar
+ *                   kernel on random text and keys
+ *
+ * @Returns: FALSE if any score differs in any bit
+ **/
+static gboolean
+kernelBatchCheck (batchFunc          kernel,
+                  const kernelModel *model)
+{
+  guint8  text[CHECKLEN];
+  guint8  keys[NUMSYMBOLS * KERNELBATCH];
+  guint8  key[KERNELKEYLEN];
+  double  got[KERNELBATCH];
+  guint32 seed = 54321;
+
+  for (int i = 0; i < CHECKLEN; i++) {
+    seed = seed * 1103515245 + 12345;
+    text[i] = (seed >> 16) % NUMSYMBOLS;
+  }
+
+  memset(key, 0, KERNELKEYLEN);
+
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    key[i] = i;
+  }
+
+  for (int k = 0; k < KERNELBATCH; k++) {
+    for (int i = NUMSYMBOLS-1; i > 0; i--) {
+      seed = seed * 1103515245 + 12345;
+
+      int    j = (seed >> 16) % (i+1);
+      guint8 tmp = key[i];
+
+      key[i] = key[j];
+      key[j] = tmp;
+    }
+
+    for (int c = 0; c < NUMSYMBOLS; c++) {
+      keys[c * KERNELBATCH + k] = key[c];
+    }
+  }
+
+  /* An odd key count exercises the leftover keys as well */
+  kernel(model, text, CHECKLEN, keys, KERNELBATCH-3, got);
+
+  for (int k = 0; k < KERNELBATCH-3; k++) {
+    for (int c = 0; c < NUMSYMBOLS; c++) {
+      key[c] = keys[c * KERNELBATCH + k];
+    }
+
+    double want = kernelAnyScalar(model, text, CHECKLEN, key);
+
+    if (memcmp(&want, &got[k], sizeof(double)) != 0) {
+      g_warning("Batch scoring kernel disagrees with generic scalar kernel\n");
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
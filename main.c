@@ -18,7 +18,11 @@
 
 
 #include <glib.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "solve.h"
 
@@ -29,6 +33,43 @@ int maxThreads  = 2;
 int popSize     = 100;
 int maxGens     = 150;
 int muteRate    = 3;
+int quantBits   = 0;
+
+gboolean histScoring = FALSE;
+
+gint64 randSeed = 0;
+
+int    solverType     = SOLVEGENETIC;
+int    annealSchedule = SCHEDGEOMETRIC;
+int    annealSteps    = 50000;
+double startTemp      = 0.0;
+
+int progressInterval = 200;
+
+int migrateInterval = 0;
+int numMigrants     = 2;
+int islandTopology  = TOPORING;
+
+int      stagnantGens  = 0;
+int      minDiversity  = 0;
+gboolean restartTrials = FALSE;
+double   timeLimit     = 0.0;
+double   targetScore   = 0.0;
+int      raceEta       = 0;
+int      initMode      = INITVOWEL;
+
+int steadyOffspring = 0;
+
+static gboolean convertModel = FALSE;
+static gboolean benchmark    = FALSE;
+static gchar   *solverName   = NULL;
+static gchar   *scheduleName = NULL;
+static gchar   *topologyName = NULL;
+static gchar   *initName     = NULL;
+static gboolean serveStdio   = FALSE;
+static gchar   *socketPath   = NULL;
+static int      numJobs      = 0;
+static gchar   *batchSource  = NULL;
 
 
 /* Command line summary and options */
@@ -36,18 +77,68 @@ static const gchar *cmdSummary =
   "Simple substitution cryptogram solver.";
 
 static const GOptionEntry cmdOption[] = {
+  { "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark,
+    "Time single and batch key evaluation instead of solving" },
+  { "convert-model", 'c', 0, G_OPTION_ARG_NONE, &convertModel,
+    "Convert text score tables to a binary model file and exit" },
   { "max-generations", 'g', 0, G_OPTION_ARG_INT, &maxGens,
     "Maximum number of generations (default=150)" },
   { "mutation-rate", 'm', 0, G_OPTION_ARG_INT, &muteRate,
     "Percent chance of mutation (default=3)" },
 	{ "ngram-length", 'n', 0, G_OPTION_ARG_INT, &ngramLen,
 		"n-gram length (default=3)" },
+  { "quantize", 'q', 0, G_OPTION_ARG_INT, &quantBits,
+    "Bits per quantized score, 8 or 16 (default=0, exact)" },
+  { "histogram", 0, 0, G_OPTION_ARG_NONE, &histScoring,
+    "Score long texts over their distinct n-grams with unquantized tables" },
+  { "seed", 'r', 0, G_OPTION_ARG_INT64, &randSeed,
+    "Random seed, to repeat a run (default=0, seed from the clock)" },
   { "max-threads", 'p', 0, G_OPTION_ARG_INT, &maxThreads,
     "Maximum number of concurrent threads (default=2)" },
   { "population-size", 's', 0, G_OPTION_ARG_INT, &popSize,
     "Size of population (default=100)" },
   { "num-trials", 't', 0, G_OPTION_ARG_INT, &numTrials,
     "Number of trials (default=5)" },
+  { "progress", 0, 0, G_OPTION_ARG_INT, &progressInterval,
+    "Milliseconds between progress updates, 0 for none (default=200)" },
+  { "solver", 0, 0, G_OPTION_ARG_STRING, &solverName,
+    "Search engine, genetic or anneal (default=genetic)" },
+  { "anneal-steps", 0, 0, G_OPTION_ARG_INT, &annealSteps,
+    "Swaps proposed per annealing trial (default=50000)" },
+  { "schedule", 0, 0, G_OPTION_ARG_STRING, &scheduleName,
+    "Annealing schedule, geometric, linear or lundy (default=geometric)" },
+  { "temperature", 0, 0, G_OPTION_ARG_DOUBLE, &startTemp,
+    "Start temperature of annealing (default=0, estimated)" },
+  { "migrate", 0, 0, G_OPTION_ARG_INT, &migrateInterval,
+    "Generations between GA island migrations (default=0, no migration)" },
+  { "migrants", 0, 0, G_OPTION_ARG_INT, &numMigrants,
+    "Best keys sent per migration (default=2)" },
+  { "topology", 0, 0, G_OPTION_ARG_STRING, &topologyName,
+    "Migration topology, ring or full (default=ring)" },
+  { "stagnation", 0, 0, G_OPTION_ARG_INT, &stagnantGens,
+    "Generations without improvement that end a GA trial (default=0, never)" },
+  { "min-diversity", 0, 0, G_OPTION_ARG_INT, &minDiversity,
+    "Percent of distinct scores below which a GA trial ends (default=0)" },
+  { "restart", 0, 0, G_OPTION_ARG_NONE, &restartTrials,
+    "Restart a stagnant GA trial from a new population instead of ending it" },
+  { "time-limit", 0, 0, G_OPTION_ARG_DOUBLE, &timeLimit,
+    "Seconds after which all trials stop (default=0, no limit)" },
+  { "target-score", 0, 0, G_OPTION_ARG_DOUBLE, &targetScore,
+    "Score at which all trials stop (default=0, none)" },
+  { "init", 0, 0, G_OPTION_ARG_STRING, &initName,
+    "Seeding of GA keys, vowel or frequency (default=vowel)" },
+  { "race", 0, 0, G_OPTION_ARG_INT, &raceEta,
+    "Race GA trials, keeping the best 1/N after each round (default=0, off)" },
+  { "steady", 0, 0, G_OPTION_ARG_INT, &steadyOffspring,
+    "Breed N GA children at a time, replacing the weakest (default=0, off)" },
+  { "serve", 0, 0, G_OPTION_ARG_NONE, &serveStdio,
+    "Solve JSON requests read from standard input, one per line" },
+  { "socket", 0, 0, G_OPTION_ARG_FILENAME, &socketPath,
+    "Solve JSON requests sent to a UNIX socket at this path" },
+  { "batch", 0, 0, G_OPTION_ARG_FILENAME, &batchSource,
+    "Solve every cryptogram of a directory or list file, printing JSON lines" },
+  { "jobs", 0, 0, G_OPTION_ARG_INT, &numJobs,
+    "Cryptograms solved at once when serving (default=max-threads)" },
 	{ NULL }
 };
 
@@ -75,6 +166,11 @@ main (int argc, char *argv[])
     return 1;
   }
 
+  if (quantBits != 0 && quantBits != 8 && quantBits != 16) {
+    g_critical("quantization parameter out of range\n");
+    return 1;
+  }
+
   if (maxThreads < 1) {
     g_critical("maximum threads parameter out of range\n");
     return 1;
@@ -85,25 +181,180 @@ main (int argc, char *argv[])
     return 1;
   }
 
+  if (popSize < 2 || popSize > MAXPOPSIZE) {
+    g_critical("population size parameter out of range\n");
+    return 1;
+  }
+
   if (muteRate < 0 || muteRate > 100) {
     g_critical("mutation rate parameter out of range\n");
     return 1;
   }
 
-	if (argc < 2) {
+  if (solverName == NULL || strcmp(solverName, "genetic") == 0) {
+    solverType = SOLVEGENETIC;
+  } else if (strcmp(solverName, "anneal") == 0) {
+    solverType = SOLVEANNEAL;
+  } else {
+    g_critical("unknown solver '%s'\n", solverName);
+    return 1;
+  }
+
+  if (scheduleName == NULL || strcmp(scheduleName, "geometric") == 0) {
+    annealSchedule = SCHEDGEOMETRIC;
+  } else if (strcmp(scheduleName, "linear") == 0) {
+    annealSchedule = SCHEDLINEAR;
+  } else if (strcmp(scheduleName, "lundy") == 0) {
+    annealSchedule = SCHEDLUNDY;
+  } else {
+    g_critical("unknown annealing schedule '%s'\n", scheduleName);
+    return 1;
+  }
+
+  if (annealSteps < 1) {
+    g_critical("annealing steps parameter out of range\n");
+    return 1;
+  }
+
+  if (startTemp < 0.0) {
+    g_critical("temperature parameter out of range\n");
+    return 1;
+  }
+
+  if (topologyName == NULL || strcmp(topologyName, "ring") == 0) {
+    islandTopology = TOPORING;
+  } else if (strcmp(topologyName, "full") == 0) {
+    islandTopology = TOPOFULL;
+  } else {
+    g_critical("unknown migration topology '%s'\n", topologyName);
+    return 1;
+  }
+
+  if (progressInterval < 0) {
+    g_critical("progress interval parameter out of range\n");
+    return 1;
+  }
+
+  if (migrateInterval < 0) {
+    g_critical("migration interval parameter out of range\n");
+    return 1;
+  }
+
+  if (migrateInterval > 0 && (numMigrants < 1 || numMigrants > MAXMIGRANTS ||
+                              numMigrants >= popSize)) {
+    g_critical("number of migrants parameter out of range\n");
+    return 1;
+  }
+
+  if (stagnantGens < 0) {
+    g_critical("stagnation parameter out of range\n");
+    return 1;
+  }
+
+  if (minDiversity < 0 || minDiversity > 100) {
+    g_critical("minimum diversity parameter out of range\n");
+    return 1;
+  }
+
+  if (!isfinite(timeLimit) || timeLimit < 0.0) {
+    g_critical("time limit parameter out of range\n");
+    return 1;
+  }
+
+  if (!isfinite(targetScore) || targetScore > 0.0) {
+    g_critical("target score parameter out of range\n");
+    return 1;
+  }
+
+  if (initName == NULL || strcmp(initName, "vowel") == 0) {
+    initMode = INITVOWEL;
+  } else if (strcmp(initName, "frequency") == 0) {
+    initMode = INITFREQ;
+  } else {
+    g_critical("unknown seeding '%s'\n", initName);
+    return 1;
+  }
+
+  if (raceEta == 1 || raceEta < 0) {
+    g_critical("racing parameter out of range\n");
+    return 1;
+  }
+
+  if (raceEta > 0 && solverType != SOLVEGENETIC) {
+    g_critical("racing requires the genetic solver\n");
+    return 1;
+  }
+
+  if (steadyOffspring < 0 || steadyOffspring >= popSize) {
+    g_critical("steady-state offspring parameter out of range\n");
+    return 1;
+  }
+
+  if (numJobs < 0) {
+    g_critical("number of jobs parameter out of range\n");
+    return 1;
+  }
+
+  if (randSeed == 0) {
+    randSeed = time(NULL);
+  }
+
+  scoreSpecialize();
+
+  if (convertModel == TRUE) {
+    gboolean status = scoreConvert("ngramscores");
+
+    scoreDone();
+    g_option_context_free(optc);
+    return (status == TRUE) ? 0 : 1;
+  }
+
+  gboolean serving = (serveStdio == TRUE || socketPath != NULL ||
+                      batchSource != NULL);
+  int      replyFd = -1;
+
+	if (argc < 2 && serving == FALSE) {
 		gchar *usage = g_option_context_get_help(optc, TRUE, NULL);
 		g_printerr("%s\n", usage);
 		g_free(usage);
 		return 1;
 	}
+
+  if (serving == TRUE && (socketPath == NULL || batchSource != NULL)) {
+    /* Keep standard output for the responses, and print all else to stderr */
+    replyFd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  }
   
   scoreInit("ngramscores");
 
-  solText = NULL;
+  if (initMode == INITFREQ &&
+      scoreUnigram("ngramscores", unigramProb) == FALSE) {
+    scoreDone();
+    g_option_context_free(optc);
+    return 1;
+  }
 
-  if (cryptoLoad(argv[1], argv[2]) == TRUE) {
-    cryptoSolve();
-    cryptoPrint(bestKey);
+  if (serving == TRUE) {
+    int jobs   = (numJobs > 0) ? numJobs : maxThreads;
+    int status = (batchSource != NULL)
+                 ? serveBatch(batchSource, replyFd, jobs)
+                 : serveRun(socketPath, replyFd, jobs);
+
+    scoreDone();
+    g_option_context_free(optc);
+    return status;
+  }
+
+  solveContext *ctx     = cryptoNew();
+  gboolean      loaded  = cryptoLoad(ctx, argv[1], argv[2]);
+  char         *bestKey = ctx->bestKey;
+
+  if (loaded == TRUE && benchmark == TRUE) {
+    cryptoBench(ctx);
+  } else if (loaded == TRUE) {
+    cryptoSolve(ctx);
+    cryptoPrint(ctx, bestKey);
 
     char encKey[NUMSYMBOLS];
 
@@ -116,14 +367,30 @@ main (int argc, char *argv[])
     printf("\nDECRYPTION KEY: %s", bestKey);
 
     printf("\nSCORE: %f  TRIAL: %d  GENERATION: %d\n", 
-           bestFit, bestTrial, bestGen);
+           ctx->bestFit, ctx->bestTrial, ctx->bestGen);
+
+    printf("BEST KEY UPDATES: %d  OFFERS: %d\n",
+           ctx->publishUpdates, ctx->publishOffers);
+
+    printf("KEYS SCORED: %d  TIME: %.3f s\n", ctx->evalCount, ctx->elapsed);
+
+    if (solverType == SOLVEGENETIC) {
+      printf("FITNESS CACHE HITS: %d  MISSES: %d\n",
+             ctx->memoHits, ctx->memoMisses);
+    }
+
+    if (quantBits > 0) {
+      printf("EXACT SCORE: %f\n",
+             scoreEvalExact(ctx->decText, ctx->textLen));
+    }
 
-    if (solText != NULL) {
-      printf("\nSCORE OF TRUE SOLUTION: %f\n", scoreEval(solText, textLen));
+    if (ctx->solText != NULL) {
+      printf("\nSCORE OF TRUE SOLUTION: %f\n",
+             scoreEval(ctx->solText, ctx->textLen));
     }
   }
 
-  cryptoFree();
+  cryptoFree(ctx);
   scoreDone();
 
   g_option_context_free(optc);  
@@ -0,0 +1,181 @@
+/*
+ * memo.c
+ * Copyright (C) Jacob Gajek 2010 <jgajek@gmail.com>
+ *
+ * Alkindus is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alkindus is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "solve.h"
+
+
+#define MEMOSIZE        4096    // Entries in a cache (power of 2)
+#define MEMOPROBE       4       // Entries searched for a key
+
+
+/*
+ * A fitness cache remembers the scores of recently evaluated keys. Late
+ * in a GA trial the population has converged and most children are
+ * copies of keys already scored, so looking them up saves a pass over
+ * the ciphertext each.
+ *
+ * The cache is a fixed-size, open-addressed hash table owned by a single
+ * trial. A key is searched for in the MEMOPROBE entries after its home
+ * entry; when they are all taken, a new key replaces the one at home.
+ */
+struct s_memoEntry {
+  guint64 hash;                 // 0 marks an empty entry
+  double  fit;
+  char    key[NUMSYMBOLS];
+};
+
+typedef struct s_memoEntry memoEntry;
+
+struct s_fitMemo {
+  memoEntry entry[MEMOSIZE];
+  int       hits;
+  int       misses;
+};
+
+static guint64 memoHash (const char *key);
+
+
+/**
+ * memoNew: Create an empty fitness cache
+ *
+ * @Returns: New cache
+ **/
+fitMemo *
+memoNew (void)
+{
+  return g_new0(fitMemo, 1);
+}
+
+
+/**
+ * memoFree: Free a fitness cache
+ *
+ * @Returns: Nothing
+ **/
+void
+memoFree (fitMemo *memo)
+{
+  g_free(memo);
+}
+
+
+/**
+ * memoStats: Get the number of lookups a cache has answered and missed
+ *
+ * @hits: Address where to store the number of answered lookups
+ * @misses: Address where to store the number of missed lookups
+ *
+ * @Returns: Nothing
+ **/
+void
+memoStats (fitMemo *memo,
+           int     *hits,
+           int     *misses)
+{
+  *hits   = memo->hits;
+  *misses = memo->misses;
+}
+
+
+/**
+ * memoLookup: Look up the score of a key
+ *
+ * @key: Decryption key
+ * @fit: Address where to store the score of @key
+ *
+ * @Returns: TRUE if the score was found
+ **/
+gboolean
+memoLookup (fitMemo    *memo,
+            const char *key,
+            double     *fit)
+{
+  guint64 hash = memoHash(key);
+
+  for (int p = 0; p < MEMOPROBE; p++) {
+    memoEntry *e = &memo->entry[(hash + p) & (MEMOSIZE-1)];
+
+    if (e->hash == hash && memcmp(e->key, key, NUMSYMBOLS) == 0) {
+      *fit = e->fit;
+      memo->hits += 1;
+      return TRUE;
+    }
+  }
+
+  memo->misses += 1;
+  return FALSE;
+}
+
+
+/**
+ * memoInsert: Remember the score of a key
+ *
+ * @key: Decryption key
+ * @fit: Score of @key
+ *
+ * @Returns: Nothing
+ **/
+void
+memoInsert (fitMemo    *memo,
+            const char *key,
+            double      fit)
+{
+  guint64    hash = memoHash(key);
+  memoEntry *slot = &memo->entry[hash & (MEMOSIZE-1)];
+
+  for (int p = 0; p < MEMOPROBE; p++) {
+    memoEntry *e = &memo->entry[(hash + p) & (MEMOSIZE-1)];
+
+    if (e->hash == 0 ||
+        (e->hash == hash && memcmp(e->key, key, NUMSYMBOLS) == 0)) {
+      slot = e;
+      break;
+    }
+  }
+
+  slot->hash = hash;
+  slot->fit  = fit;
+  memcpy(slot->key, key, NUMSYMBOLS);
+}
+
+
+/**
+ * memoHash: Hash the NUMSYMBOLS letters of a key, read as four 64-bit
+ *           words
+ *
+ * @Returns: Hash value, never 0
+ **/
+static guint64
+memoHash (const char *key)
+{
+  guint64 w[4] = { 0, 0, 0, 0 };
+
+  memcpy(w, key, NUMSYMBOLS);
+
+  guint64 h = w[0] * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+
+  h = (h ^ w[1]) * G_GUINT64_CONSTANT(0xBF58476D1CE4E5B9);
+  h = (h ^ w[2]) * G_GUINT64_CONSTANT(0x94D049BB133111EB);
+  h = (h ^ w[3]) * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+  h ^= h >> 32;
+
+  return h | 1;
+}
@@ -0,0 +1,503 @@
+/*
+ * pool.c
+ * Copyright (C) Jacob Gajek 2010 <jgajek@gmail.com>
+ *
+ * Alkindus is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alkindus is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "solve.h"
+
+
+#define POOLDEQUESIZE   64      // Initial capacity of a worker's deque
+
+
+/*
+ * A work-stealing thread pool. Every worker owns a deque of tasks: it
+ * takes its own work from the newest end, and an idle worker steals the
+ * oldest task of another worker. Tasks pushed by a running task go to
+ * the deque of its worker, so a trial can split off sub-tasks that idle
+ * workers pick up, and wait for them with poolJoin while running those
+ * still queued itself. poolJoin runs no other tasks, so a trial is never
+ * held up under an unrelated one. Tasks pushed from outside the pool are
+ * spread over the deques.
+ *
+ * The pool mutex guards the counts of queued and running tasks, which
+ * idle workers sleep on and poolWait watches for completion. The last
+ * task of a group also finishes under it, so that poolJoin and poolWait
+ * can wait for a single group. Each deque has its own mutex.
+ */
+struct s_poolTask {
+  GFunc      func;
+  gpointer   data;
+  gpointer   udata;
+  poolGroup *group;
+};
+
+typedef struct s_poolTask poolTask;
+
+struct s_poolWorker {
+  workPool *pool;
+  GMutex   *lock;
+  poolTask *tasks;      // Ring buffer of tasks
+  int       head;       // Index of the oldest task
+  int       count;
+  int       size;
+};
+
+typedef struct s_poolWorker poolWorker;
+
+struct s_workPool {
+  poolWorker *workers;
+  GThread   **threads;
+  int         numWorkers;
+  int         next;     // Deque for the next task pushed from outside
+
+  GMutex     *lock;
+  GCond      *wake;     // Signalled when a task is queued or on shutdown
+  GCond      *done;     // Signalled when the pool or a group goes idle
+  int         queued;
+  int         running;
+  gboolean    stop;
+};
+
+static GStaticPrivate poolSelf = G_STATIC_PRIVATE_INIT;
+
+static gpointer poolThread (gpointer data);
+static gboolean poolTake   (poolWorker *self, poolTask *task);
+static gboolean poolTakeGroup (poolWorker *self, poolGroup *group,
+                               poolTask *task);
+static void     poolRun    (poolWorker *self, poolTask *task);
+
+
+/**
+ * poolNew: Create a work-stealing thread pool
+ *
+ * @threads: Number of worker threads
+ *
+ * @Returns: New pool
+ **/
+workPool *
+poolNew (int threads)
+{
+  workPool *pool = g_new0(workPool, 1);
+
+  pool->numWorkers = MAX(threads, 1);
+  pool->workers    = g_new0(poolWorker, pool->numWorkers);
+  pool->threads    = g_new0(GThread *, pool->numWorkers);
+  pool->lock       = g_mutex_new();
+  pool->wake       = g_cond_new();
+  pool->done       = g_cond_new();
+
+  for (int i = 0; i < pool->numWorkers; i++) {
+    poolWorker *w = &pool->workers[i];
+
+    w->pool  = pool;
+    w->lock  = g_mutex_new();
+    w->size  = POOLDEQUESIZE;
+    w->tasks = g_new(poolTask, w->size);
+  }
+
+  for (int i = 0; i < pool->numWorkers; i++) {
+    pool->threads[i] = g_thread_create(poolThread, &pool->workers[i],
+                                       TRUE, NULL);
+  }
+
+  return pool;
+}
+
+
+/**
+ * poolFree: Wait for all tasks to finish, then stop the worker threads
+ *           and free the pool
+ *
+ * @Returns: Nothing
+ **/
+void
+poolFree (workPool *pool)
+{
+  poolWait(pool, NULL, -1);
+
+  g_mutex_lock(pool->lock);
+  pool->stop = TRUE;
+  g_cond_broadcast(pool->wake);
+  g_mutex_unlock(pool->lock);
+
+  for (int i = 0; i < pool->numWorkers; i++) {
+    g_thread_join(pool->threads[i]);
+  }
+
+  for (int i = 0; i < pool->numWorkers; i++) {
+    g_mutex_free(pool->workers[i].lock);
+    g_free(pool->workers[i].tasks);
+  }
+
+  g_mutex_free(pool->lock);
+  g_cond_free(pool->wake);
+  g_cond_free(pool->done);
+  g_free(pool->workers);
+  g_free(pool->threads);
+  g_free(pool);
+}
+
+
+/**
+ * poolPush: Queue a task. Called from a task of the same pool, the task
+ *           goes to the deque of the calling worker.
+ *
+ * @func: Function to run
+ * @data: First argument of @func
+ * @udata: Second argument of @func
+ * @group: Group to count the task in, or NULL
+ *
+ * @Returns: Nothing
+ **/
+void
+poolPush (workPool  *pool,
+          GFunc      func,
+          gpointer   data,
+          gpointer   udata,
+          poolGroup *group)
+{
+  poolWorker *self = g_static_private_get(&poolSelf);
+  poolWorker *w;
+
+  if (group != NULL) {
+    g_atomic_int_inc(&group->pending);
+  }
+
+  /* Count the task first, so that the pool never looks idle too early */
+  g_mutex_lock(pool->lock);
+  pool->queued += 1;
+
+  if (self != NULL && self->pool == pool) {
+    w = self;
+  } else {
+    w = &pool->workers[pool->next];
+    pool->next = (pool->next + 1) % pool->numWorkers;
+  }
+
+  g_mutex_unlock(pool->lock);
+
+  g_mutex_lock(w->lock);
+
+  if (w->count == w->size) {
+    poolTask *tasks = g_new(poolTask, 2 * w->size);
+
+    for (int i = 0; i < w->count; i++) {
+      tasks[i] = w->tasks[(w->head + i) % w->size];
+    }
+
+    g_free(w->tasks);
+    w->tasks = tasks;
+    w->head  = 0;
+    w->size *= 2;
+  }
+
+  poolTask *task = &w->tasks[(w->head + w->count) % w->size];
+
+  task->func  = func;
+  task->data  = data;
+  task->udata = udata;
+  task->group = group;
+  w->count   += 1;
+
+  g_mutex_unlock(w->lock);
+
+  g_mutex_lock(pool->lock);
+  g_cond_signal(pool->wake);
+  g_mutex_unlock(pool->lock);
+}
+
+
+/**
+ * poolJoin: Wait until every task of a group has finished. A worker of
+ *           the pool runs the tasks of the group still in its deque while
+ *           it waits, so a task can wait for its own sub-tasks without
+ *           tying up its thread. Once the rest are running elsewhere, it
+ *           sleeps until they finish.
+ *
+ * @group: Group to wait for, whose tasks the caller pushed
+ *
+ * @Returns: Nothing
+ **/
+void
+poolJoin (workPool  *pool,
+          poolGroup *group)
+{
+  poolWorker *self = g_static_private_get(&poolSelf);
+  poolTask    task;
+
+  if (self != NULL && self->pool == pool) {
+    while (poolTakeGroup(self, group, &task)) {
+      poolRun(self, &task);
+    }
+  }
+
+  g_mutex_lock(pool->lock);
+
+  while (g_atomic_int_get(&group->pending) > 0) {
+    g_cond_wait(pool->done, pool->lock);
+  }
+
+  g_mutex_unlock(pool->lock);
+}
+
+
+/**
+ * poolWait: Wait until no task of a group, or of the whole pool, is
+ *           queued or running. Unlike poolJoin, the caller only sleeps,
+ *           so it must not be a worker of the pool.
+ *
+ * @group: Group to wait for, or NULL to wait for the pool to go idle
+ * @timeout: Longest time to wait in microseconds, or -1 to wait forever
+ *
+ * @Returns: TRUE if the group or pool is idle, FALSE on timeout
+ **/
+gboolean
+poolWait (workPool  *pool,
+          poolGroup *group,
+          gint64     timeout)
+{
+  GTimeVal until;
+  gboolean idle;
+
+  g_get_current_time(&until);
+  g_time_val_add(&until, MAX(timeout, 0));
+
+  g_mutex_lock(pool->lock);
+
+  for (;;) {
+    if (group != NULL) {
+      idle = (g_atomic_int_get(&group->pending) == 0);
+    } else {
+      idle = (pool->queued == 0 && pool->running == 0);
+    }
+
+    if (idle == TRUE) {
+      break;
+    }
+
+    if (timeout < 0) {
+      g_cond_wait(pool->done, pool->lock);
+    } else if (!g_cond_timed_wait(pool->done, pool->lock, &until)) {
+      break;
+    }
+  }
+
+  g_mutex_unlock(pool->lock);
+
+  return idle;
+}
+
+
+/**
+ * poolStatus: Get the number of queued and running tasks
+ *
+ * @queued: Address where to store the number of queued tasks
+ * @running: Address where to store the number of running tasks
+ *
+ * @Returns: Nothing
+ **/
+void
+poolStatus (workPool *pool,
+            int      *queued,
+            int      *running)
+{
+  g_mutex_lock(pool->lock);
+  *queued  = pool->queued;
+  *running = pool->running;
+  g_mutex_unlock(pool->lock);
+}
+
+
+/**
+ * poolCurrent: Get the pool whose task the calling thread is running
+ *
+ * @Returns: Pool, or NULL outside of a pool
+ **/
+workPool *
+poolCurrent (void)
+{
+  poolWorker *self = g_static_private_get(&poolSelf);
+
+  return (self != NULL) ? self->pool : NULL;
+}
+
+
+/**
+ * poolThread: Main loop of a worker thread
+ *
+ * @data: Worker
+ *
+ * @Returns: NULL
+ **/
+static gpointer
+poolThread (gpointer data)
+{
+  poolWorker *self = data;
+  workPool   *pool = self->pool;
+
+  g_static_private_set(&poolSelf, self, NULL);
+
+  for (;;) {
+    poolTask task;
+
+    if (poolTake(self, &task)) {
+      poolRun(self, &task);
+      continue;
+    }
+
+    g_mutex_lock(pool->lock);
+
+    while (pool->queued == 0 && pool->stop == FALSE) {
+      g_cond_wait(pool->wake, pool->lock);
+    }
+
+    gboolean stop = (pool->queued == 0 && pool->stop == TRUE);
+
+    g_mutex_unlock(pool->lock);
+
+    if (stop == TRUE) {
+      return NULL;
+    }
+  }
+}
+
+
+/**
+ * poolTake: Take the newest task of the worker's own deque, or else steal
+ *           the oldest task of another worker
+ *
+ * @self: Calling worker
+ * @task: Address where to store the task
+ *
+ * @Returns: FALSE if no task was found
+ **/
+static gboolean
+poolTake (poolWorker *self,
+          poolTask   *task)
+{
+  workPool *pool  = self->pool;
+  int       first = self - pool->workers;
+  gboolean  found = FALSE;
+
+  for (int i = 0; i < pool->numWorkers && found == FALSE; i++) {
+    poolWorker *w = &pool->workers[(first + i) % pool->numWorkers];
+
+    g_mutex_lock(w->lock);
+
+    if (w->count > 0) {
+      if (w == self) {
+        *task = w->tasks[(w->head + w->count-1) % w->size];
+      } else {
+        *task = w->tasks[w->head];
+        w->head = (w->head + 1) % w->size;
+      }
+
+      w->count -= 1;
+      found = TRUE;
+    }
+
+    g_mutex_unlock(w->lock);
+  }
+
+  if (found == TRUE) {
+    g_mutex_lock(pool->lock);
+    pool->queued  -= 1;
+    pool->running += 1;
+    g_mutex_unlock(pool->lock);
+  }
+
+  return found;
+}
+
+
+/**
+ * poolTakeGroup: Take the newest task of a group from the worker's own
+ *                deque, where a worker's sub-tasks are queued
+ *
+ * @self: Calling worker
+ * @group: Group of the task
+ * @task: Address where to store the task
+ *
+ * @Returns: FALSE if the deque holds no task of the group
+ **/
+static gboolean
+poolTakeGroup (poolWorker *self,
+               poolGroup  *group,
+               poolTask   *task)
+{
+  workPool *pool  = self->pool;
+  gboolean  found = FALSE;
+
+  g_mutex_lock(self->lock);
+
+  for (int i = self->count-1; i >= 0 && found == FALSE; i--) {
+    if (self->tasks[(self->head + i) % self->size].group != group) {
+      continue;
+    }
+
+    *task = self->tasks[(self->head + i) % self->size];
+
+    /* Close the gap left in the ring buffer */
+    for (int k = i; k < self->count-1; k++) {
+      self->tasks[(self->head + k) % self->size] =
+        self->tasks[(self->head + k+1) % self->size];
+    }
+
+    self->count -= 1;
+    found = TRUE;
+  }
+
+  g_mutex_unlock(self->lock);
+
+  if (found == TRUE) {
+    g_mutex_lock(pool->lock);
+    pool->queued  -= 1;
+    pool->running += 1;
+    g_mutex_unlock(pool->lock);
+  }
+
+  return found;
+}
+
+
+/**
+ * poolRun: Run a task taken from a deque and account for its completion
+ *
+ * @Returns: Nothing
+ **/
+static void
+poolRun (poolWorker *self,
+         poolTask   *task)
+{
+  workPool *pool = self->pool;
+
+  task->func(task->data, task->udata);
+
+  g_mutex_lock(pool->lock);
+  pool->running -= 1;
+
+  gboolean groupDone = (task->group != NULL &&
+                        g_atomic_int_dec_and_test(&task->group->pending));
+
+  if (groupDone == TRUE || (pool->queued == 0 && pool->running == 0)) {
+    g_cond_broadcast(pool->done);
+  }
+
+  g_mutex_unlock(pool->lock);
+}
@@ -0,0 +1,127 @@
+/*
+ * rng.c
+ * Copyright (C) Jacob Gajek 2010 <jgajek@gmail.com>
+ *
+ * Alkindus is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alkindus is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "solve.h"
+
+
+/*
+ * Random numbers come from xoshiro256** (Blackman and Vigna). Every trial
+ * owns its own generator state, seeded from the --seed option and the
+ * trial number, so trials never share state and a run can be repeated
+ * exactly.
+ */
+static guint64 rngSplitMix (guint64 *x);
+
+
+/**
+ * rngInit: Seed a random number generator
+ *
+ * @rng: Generator state to initialize
+ * @seed: Seed of the run
+ * @stream: Number distinguishing generators with the same seed
+ *
+ * @Returns: Nothing
+ **/
+void
+rngInit (rngState *rng,
+         guint64   seed,
+         guint64   stream)
+{
+  guint64 x = seed;
+  guint64 y = rngSplitMix(&x) ^ stream;
+
+  /* Expand the seed so that no two streams start from related states */
+  for (int i = 0; i < 4; i++) {
+    rng->s[i] = rngSplitMix(&y);
+  }
+}
+
+
+/**
+ * rngNext: Draw 64 random bits
+ *
+ * @Returns: Random number
+ **/
+guint64
+rngNext (rngState *rng)
+{
+  guint64 *s = rng->s;
+  guint64 r  = s[1] * 5;
+  guint64 t  = s[1] << 17;
+
+  r = ((r << 7) | (r >> 57)) * 9;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = (s[3] << 45) | (s[3] >> 19);
+
+  return r;
+}
+
+
+/**
+ * rngInt: Draw a random integer in the range 0 .. @n-1, by scaling the
+ *         top 32 bits rather than taking a remainder. The bias is at most
+ *         n/2^32.
+ *
+ * @n: Size of range (1 .. 2^31-1)
+ *
+ * @Returns: Random number
+ **/
+int
+rngInt (rngState *rng,
+        int       n)
+{
+  return (int) (((rngNext(rng) >> 32) * (guint64) n) >> 32);
+}
+
+
+/**
+ * rngDouble: Draw a random number uniformly distributed in [0, 1)
+ *
+ * @Returns: Random number
+ **/
+double
+rngDouble (rngState *rng)
+{
+  return (rngNext(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/**
+ * rngSplitMix: Step the SplitMix64 generator used for seeding
+ *
+ * @x: SplitMix64 state
+ *
+ * @Returns: Random number
+ **/
+static guint64
+rngSplitMix (guint64 *x)
+{
+  guint64 z = (*x += G_GUINT64_CONSTANT(0x9E3779B97F4A7C15));
+
+  z = (z ^ (z >> 30)) * G_GUINT64_CONSTANT(0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * G_GUINT64_CONSTANT(0x94D049BB133111EB);
+
+  return z ^ (z >> 31);
+}
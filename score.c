@@ -16,142 +16,719 @@
  * with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+
 #include <glib.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "solve.h"
 
-#define CHUNKSIZE   65536
+#define SPARSEPREFIX  4     // Leading symbols resolved by sparse bucket index
+#define QUANTMAX      32767 // Largest 16-bit quantized table value
+#define QUANT8MAX     127   // Largest 8-bit quantized table value
 
+#define MODELMAGIC    "ALKSCORE"
+#define MODELVERSION  1
+#define MODELDENSE    1     // Layout: dense prior and conditional arrays
+#define MODELSPARSE   2     // Layout: sparse prior and conditional tables
 
-struct s_ngramScore {
-  double value;
-  struct s_ngramScore *next;
+
+/*
+ * Scores read from a text table, keyed by the base-26 value of the n-gram
+ * and sorted by key.
+ */
+struct s_ngramEntry {
+  guint64 key;
+  double  value;
+};
+
+typedef struct s_ngramEntry ngramEntry;
+
+
+/*
+ * Sparse tables hold only the n-grams present in the model. A bucket
+ * directory indexed by the leading SPARSEPREFIX symbols gives the range of
+ * entries sharing that prefix; within it the remaining symbols are stored
+ * as sorted 32-bit keys and found by binary search. Log-probabilities are
+ * quantized to 16 bits, so an entry costs six bytes.
+ */
+struct s_sparseHeader {
+  guint64 count;        // Number of stored n-grams
+  guint32 len;          // N-gram length
+  guint32 prefixLen;    // Leading symbols resolved by the bucket directory
+  double  scale;        // Log-probability of one quantization step
+  double  missing;      // Score of n-grams not stored in the table
+};
+
+typedef struct s_sparseHeader sparseHeader;
+
+struct s_sparseTable {
+  sparseHeader header;
+  guint64  space;       // Number of possible n-grams (26^len)
+  guint64  suffixSpace; // Number of possible suffixes after the prefix
+  guint32 *bucket;      // 26^prefixLen+1 offsets into keys and values
+  guint32 *keys;        // Base-26 values of the n-gram suffixes
+  gint16  *values;      // Quantized log-probabilities
+};
+
+typedef struct s_sparseTable sparseTable;
+
+
+/*
+ * Binary model files hold the score tables in the layout used for scoring,
+ * in native byte order, so that scoreInit can map them read-only and share
+ * a single page cache copy between processes. In the dense layout the
+ * header is followed by priorSize prior and condSize conditional
+ * log-probabilities. In the sparse layout it is followed by the prior and
+ * conditional sparse tables, each as its sparseHeader, bucket directory,
+ * keys and values, padded to a multiple of eight bytes; priorSize and
+ * condSize then count the stored n-grams.
+ */
+struct s_modelHeader {
+  char    magic[8];
+  guint32 version;
+  guint32 layout;
+  guint32 ngramLen;
+  guint32 reserved;
+  double  scoreZero;
+  guint64 priorSize;
+  guint64 condSize;
 };
 
-typedef struct s_ngramScore ngramScore;
+typedef struct s_modelHeader modelHeader;
 
 
 /*
- * Absolute probabilities for (n-1)-grams are stored in hash table scorePrior.
- * Conditional probabilities for n-grams are stored in hash table scoreCond.
  * Probability for unseen n-grams is stored in scoreZero.
+ *
+ * When the model is small enough, scores are stored in flat arrays indexed
+ * by the base-26 value of the n-gram, so that scoreEval can use a rolling
+ * index. Unseen n-grams hold scoreZero in denseCond and 0 in densePrior.
+ * Longer models are stored in the sparse tables sparsePrior and sparseCond.
  */
-static ngramScore   *scoreList;     // Linked list for easy deallocation
-static GHashTable   *scorePrior;
-static GHashTable   *scoreCond;
 static double        scoreZero;
-static guint         countZero;
 
-static GStringChunk *ngramChunk;
+static double       *densePrior;
+static double       *denseCond;
+static guint         densePriorSize;
+
+static sparseTable   sparsePrior;
+static sparseTable   sparseCond;
+
+/*
+ * With the --quantize option, scoreEval and scoreNgram use copies of the
+ * dense tables holding 16-bit or 8-bit multiples of quantScale, which fit
+ * in cache far better. Scores are accumulated as integers.
+ */
+static gint16       *quant16Prior;
+static gint16       *quant16Cond;
+static gint8        *quant8Prior;
+static gint8        *quant8Cond;
+static double        quantScale;
+
+/*
+ * Dense double or 16-bit tables are scored by the fastest kernel the CPU
+ * supports (see kernel.c); scoreKernel is NULL for other tables.
+ */
+static kernelModel   scoreModel;
+static kernelFunc    scoreKernel;
+
+static GMappedFile  *scoreMap;      // Binary model file, if one is mapped
+
+/*
+ * No n-gram scores higher than scoreMaxCond, which is at most 0. The
+ * windows still to be summed by a bounded delta scoring loop can add at
+ * most this much each, so the loop stops once its partial sum plus that
+ * bound falls below the limit it was given.
+ */
+static double        scoreMaxCond;
+
+/*
+ * Text and delta scoring loops for tables without a kernel, instantiated
+ * for each n-gram length by SCOREINSTANCE and chosen by scoreSpecialize
+ */
+typedef double (*keyFunc) (const guint8 *text, int len, const guint8 *key);
+
+typedef double (*winFunc) (const guint8 *text, const int *wx, int nx,
+                           const int *wy, int ny, const guint8 *key,
+                           double limit);
+
+typedef double (*histFunc) (const guint8 *text, const guint8 *grams,
+                            const int *counts, int num, const guint8 *key);
+
+typedef double (*histWinFunc) (const guint8 *text, const guint8 *grams,
+                               const int *counts, const int *hx, int nx,
+                               const int *hy, int ny, const guint8 *key,
+                               double limit);
+
+
+static void     scoreReset      (void);
+static void     scoreQuantInit  (void);
+static void     scoreKernelInit (void);
+static void     scoreBoundInit  (void);
+static double   scoreLookup     (guint64 index, int len);
+static gint64   scoreLookupQuant(guint64 index, int len);
+static gboolean scoreLoadText   (const char *file);
+static gboolean scoreReadTable  (const char *file, int len,
+                                 ngramEntry **list, gsize *count);
+static gboolean scoreMapModel   (const char *file);
+static gboolean scoreMapSparse  (sparseTable *table, const guchar **pos,
+                                 const guchar *end, int len);
+static gboolean scoreWriteModel (const char *file);
+static gboolean scoreWriteSparse(FILE *fp, sparseTable *table);
+static gboolean scoreDenseInit  (ngramEntry *prior, gsize numPrior,
+                                 ngramEntry *cond, gsize numCond);
+static void     scoreSparseInit (sparseTable *table, ngramEntry *list,
+                                 gsize count, int len, double missing);
+static void     scoreSparseSize (sparseTable *table, int len, int prefixLen);
+static gsize    scoreSparseBytes(sparseTable *table);
+static double   scoreSparseFind (sparseTable *table, guint64 index);
+static guint64  scoreIndex      (const char *ngram, int len);
+
+
+/**
+ * scoreKeyN: Evaluate a text decrypted with a key by walking a rolling
+ *            n-gram index over it
+ *
+ * @n: N-gram length
+ *
+ * @Returns: Probability of decrypted text
+ **/
+static inline __attribute__((always_inline)) double
+scoreKeyN (const guint8 *text,
+           int           len,
+           const guint8 *key,
+           const int     n)
+{
+  guint64 span  = 1;
+  guint64 index = 0;
+
+  for (int k = 0; k < n-1; k++) {
+    span *= NUMSYMBOLS;
+    index = index * NUMSYMBOLS + key[text[k]];
+  }
+
+  /* Quantized scores are summed exactly, as by scoreEval */
+  if (quant16Cond != NULL || quant8Cond != NULL) {
+    gint64 units = scoreLookupQuant(index, n-1);
+
+    for (int i = n-1; i < len; i++) {
+      index = index * NUMSYMBOLS + key[text[i]];
+      units += scoreLookupQuant(index, n);
+      index %= span;
+    }
+
+    return units * quantScale;
+  }
+
+  double score = scoreLookup(index, n-1);
+
+  for (int i = n-1; i < len; i++) {
+    index = index * NUMSYMBOLS + key[text[i]];
+    score += scoreLookup(index, n);
+    index %= span;
+  }
+
+  return score;
+}
+
+
+/**
+ * scoreWinN: Sum the probabilities of two sorted lists of windows, see
+ *            scoreEvalWinBounded
+ *
+ * @n: N-gram length
+ *
+ * @Returns: Partial probability of decrypted text
+ **/
+static inline __attribute__((always_inline)) double
+scoreWinN (const guint8 *text,
+           const int    *wx,
+           int           nx,
+           const int    *wy,
+           int           ny,
+           const guint8 *key,
+           double        limit,
+           const int     n)
+{
+  double score = 0.0000000000;
+  int i = 0;
+  int j = 0;
+
+  while (i < nx || j < ny) {
+    int w;
+
+    /* Merge the two sorted window lists */
+    if (j == ny || (i < nx && wx[i] < wy[j])) {
+      w = wx[i++];
+    } else if (i == nx || wy[j] < wx[i]) {
+      w = wy[j++];
+    } else {
+      w = wx[i++];
+      j++;
+    }
+
+    guint64 index = 0;
+
+    if (w < n-1) {
+      for (int k = 0; k < n-1; k++) {
+        index = index * NUMSYMBOLS + key[text[k]];
+      }
+
+      score += scoreLookup(index, n-1);
+    } else {
+      for (int k = w-n+1; k <= w; k++) {
+        index = index * NUMSYMBOLS + key[text[k]];
+      }
+
+      score += scoreLookup(index, n);
+    }
+
+    /* Windows after the first are all full n-grams */
+    double bound = MAX(nx-i, ny-j) * scoreMaxCond;
+
+    if (score + bound < limit) {
+      return score + bound;
+    }
+  }
+
+  return score;
+}
+
+
+/**
+ * scoreHistN: Sum the probabilities of a list of n-grams weighted by their
+ *             counts, see scoreEvalHist
+ *
+ * @n: N-gram length
+ *
+ * @Returns: Probability of decrypted text
+ **/
+static inline __attribute__((always_inline)) double
+scoreHistN (const guint8 *text,
+            const guint8 *grams,
+            const int    *counts,
+            int           num,
+            const guint8 *key,
+            const int     n)
+{
+  guint64 index = 0;
+
+  for (int k = 0; k < n-1; k++) {
+    index = index * NUMSYMBOLS + key[text[k]];
+  }
+
+  /* Summed exactly, this agrees bit for bit with a scan of the text */
+  if (quant16Cond != NULL || quant8Cond != NULL) {
+    gint64 units = scoreLookupQuant(index, n-1);
+
+    for (int i = 0; i < num; i++, grams += n) {
+      index = 0;
+
+      for (int k = 0; k < n; k++) {
+        index = index * NUMSYMBOLS + key[grams[k]];
+      }
+
+      units += counts[i] * scoreLookupQuant(index, n);
+    }
+
+    return units * quantScale;
+  }
+
+  double score = scoreLookup(index, n-1);
+
+  for (int i = 0; i < num; i++, grams += n) {
+    index = 0;
+
+    for (int k = 0; k < n; k++) {
+      index = index * NUMSYMBOLS + key[grams[k]];
+    }
+
+    score += counts[i] * scoreLookup(index, n);
+  }
+
+  return score;
+}
+
+
+/**
+ * scoreHistWinN: Sum the probabilities of the n-grams in two sorted lists
+ *                of histogram entries, see scoreEvalHistWinBounded
+ *
+ * @n: N-gram length
+ *
+ * @Returns: Partial probability of decrypted text
+ **/
+static inline __attribute__((always_inline)) double
+scoreHistWinN (const guint8 *text,
+               const guint8 *grams,
+               const int    *counts,
+               const int    *hx,
+               int           nx,
+               const int    *hy,
+               int           ny,
+               const guint8 *key,
+               double        limit,
+               const int     n)
+{
+  double score = 0.0000000000;
+  int i = 0;
+  int j = 0;
+
+  while (i < nx || j < ny) {
+    int e;
+
+    /* Merge the two sorted entry lists */
+    if (j == ny || (i < nx && hx[i] < hy[j])) {
+      e = hx[i++];
+    } else if (i == nx || hy[j] < hx[i]) {
+      e = hy[j++];
+    } else {
+      e = hx[i++];
+      j++;
+    }
+
+    guint64 index = 0;
+
+    if (e < 0) {
+      for (int k = 0; k < n-1; k++) {
+        index = index * NUMSYMBOLS + key[text[k]];
+      }
+
+      score += scoreLookup(index, n-1);
+    } else {
+      const guint8 *gram = &grams[e*n];
+
+      for (int k = 0; k < n; k++) {
+        index = index * NUMSYMBOLS + key[gram[k]];
+      }
+
+      score += counts[e] * scoreLookup(index, n);
+    }
+
+    /* Each entry left occurs at least once */
+    double bound = MAX(nx-i, ny-j) * scoreMaxCond;
+
+    if (score + bound < limit) {
+      return score + bound;
+    }
+  }
+
+  return score;
+}
+
+
+#define SCOREINSTANCE(name, n)                                              \
+static double                                                               \
+scoreKey##name (const guint8 *text, int len, const guint8 *key)            \
+{                                                                           \
+  return scoreKeyN(text, len, key, n);                                      \
+}                                                                           \
+                                                                            \
+static double                                                               \
+scoreWin##name (const guint8 *text, const int *wx, int nx,                 \
+                const int *wy, int ny, const guint8 *key, double limit)     \
+{                                                                           \
+  return scoreWinN(text, wx, nx, wy, ny, key, limit, n);                    \
+}                                                                           \
+                                                                            \
+static double                                                               \
+scoreHist##name (const guint8 *text, const guint8 *grams,                  \
+                 const int *counts, int num, const guint8 *key)             \
+{                                                                           \
+  return scoreHistN(text, grams, counts, num, key, n);                      \
+}                                                                           \
+                                                                            \
+static double                                                               \
+scoreHistWin##name (const guint8 *text, const guint8 *grams,               \
+                    const int *counts, const int *hx, int nx,               \
+                    const int *hy, int ny, const guint8 *key,               \
+                    double limit)                                           \
+{                                                                           \
+  return scoreHistWinN(text, grams, counts, hx, nx, hy, ny, key, limit, n); \
+}
+
+SCOREINSTANCE(Any, ngramLen)
+SCOREINSTANCE(2, 2)
+SCOREINSTANCE(3, 3)
+SCOREINSTANCE(4, 4)
+SCOREINSTANCE(5, 5)
+SCOREINSTANCE(6, 6)
+SCOREINSTANCE(7, 7)
+SCOREINSTANCE(8, 8)
+
+static keyFunc       scoreKeyFunc     = scoreKeyAny;
+static winFunc       scoreWinFunc     = scoreWinAny;
+static histFunc      scoreHistFunc    = scoreHistAny;
+static histWinFunc   scoreHistWinFunc = scoreHistWinAny;
 
 
 /**
- * scoreInit: Initialize n-gram score table
+ * scoreInit: Initialize n-gram score table. Maps the binary model file
+ *            '<file>.<n>.bin' if present, otherwise reads the text tables
+ *            '<file>.<n-1>' and '<file>.<n>'.
  *
  * @Returns: FALSE if an error occurs
  **/
 gboolean
 scoreInit (const char *file)
 {
-  GString *scoreFile;
-  GString *format;
-  FILE *fp;
+  scoreReset();
 
-  scoreList = NULL;
+  if (scoreMapModel(file) == FALSE && scoreLoadText(file) == FALSE) {
+    return FALSE;
+  }
 
-  ngramChunk = g_string_chunk_new(CHUNKSIZE);
-  scorePrior = g_hash_table_new(g_str_hash, g_str_equal);
-  scoreCond  = g_hash_table_new(g_str_hash, g_str_equal);
-  scoreFile  = g_string_sized_new(strlen(file)+4);
-  format     = g_string_sized_new(16);
+  if (quantBits > 0) {
+    scoreQuantInit();
+  }
+
+  scoreKernelInit();
+  scoreBoundInit();
+
+  return TRUE;
+}
+
+
+/**
+ * scoreConvert: Convert text score tables into a binary model file
+ *
+ * @file: Base name of score tables
+ *
+ * @Returns: FALSE if an error occurs
+ **/
+gboolean
+scoreConvert (const char *file)
+{
+  scoreReset();
+
+  if (scoreLoadText(file) == FALSE) {
+    return FALSE;
+  }
+
+  return scoreWriteModel(file);
+}
 
-  gchar *ngramBuf = g_malloc0(MAXNGRAMLEN+1);
-  scoreZero = 1.0000000000;
-  countZero = pow(NUMSYMBOLS, ngramLen);
-  
-  double value;
 
-  /* Read in (n-1)-gram probabilities */
-  g_string_printf(scoreFile, "%s.%d", file, ngramLen-1);
-  g_string_printf(format, " %%%d[a-z] %%lf", ngramLen-1);
+/**
+ * scoreUnigram: Read the letter probabilities of the text table
+ *               '<file>.1'
+ *
+ * @file: Base name of score tables
+ * @prob: Address where to store the probability of each letter; letters
+ *        missing from the table get 0
+ *
+ * @Returns: FALSE if an error occurs
+ **/
+gboolean
+scoreUnigram (const char *file,
+              double     *prob)
+{
+  ngramEntry *list = NULL;
+  gsize count;
 
-  if ((fp = fopen(scoreFile->str, "r")) == NULL) {
-    g_critical("Error opening file '%s' for reading\n", scoreFile->str);
+  if (scoreReadTable(file, 1, &list, &count) == FALSE) {
+    g_free(list);
     return FALSE;
   }
 
-  while (!feof(fp)) {
-    if(fscanf(fp, format->str, ngramBuf, &value) != 2) {
-      if (feof(fp)) {
-        break;
-      } else {
-        g_critical("Error reading score data in '%s'\n", scoreFile->str);
-        return FALSE;
-      }
+  for (int i = 0; i < NUMSYMBOLS; i++) {
+    prob[i] = 0.0;
+  }
+
+  for (gsize i = 0; i < count; i++) {
+    prob[list[i].key] = list[i].value;
+  }
+
+  g_free(list);
+
+  return TRUE;
+}
+
+
+/**
+ * scoreReset: Mark all score tables as unallocated
+ *
+ * @Returns: Nothing
+ **/
+static void
+scoreReset (void)
+{
+  scoreMap   = NULL;
+  densePrior = NULL;
+  denseCond  = NULL;
+
+  quant16Prior = NULL;
+  quant16Cond  = NULL;
+  quant8Prior  = NULL;
+  quant8Cond   = NULL;
+
+  scoreKernel  = NULL;
+
+  memset(&sparsePrior, 0, sizeof(sparseTable));
+  memset(&sparseCond, 0, sizeof(sparseTable));
+}
+
+
+/**
+ * scoreLoadText: Read n-gram score tables from text files and store them
+ *                in dense tables if they fit, sparse tables otherwise
+ *
+ * @Returns: FALSE if an error occurs
+ **/
+static gboolean
+scoreLoadText (const char *file)
+{
+  ngramEntry *prior = NULL;
+  ngramEntry *cond  = NULL;
+  gsize numPrior;
+  gsize numCond;
+
+  /* Read in (n-1)-gram and n-gram probabilities */
+  if (scoreReadTable(file, ngramLen-1, &prior, &numPrior) == FALSE ||
+      scoreReadTable(file, ngramLen, &cond, &numCond) == FALSE) {
+    g_free(prior);
+    g_free(cond);
+    return FALSE;
+  }
+
+  for (gsize i = 0; i < numPrior; i++) {
+    prior[i].value = log(prior[i].value);
+  }
+
+  /* Convert n-gram probabilities to conditional probabilities */
+  double countZero = pow(NUMSYMBOLS, ngramLen) - numCond;
+  gsize  p = 0;
+
+  scoreZero = 1.0000000000;
+
+  for (gsize i = 0; i < numCond; i++) {
+    guint64 prefix = cond[i].key / NUMSYMBOLS;
+
+    while (p < numPrior && prior[p].key < prefix) {
+      p++;
     }
 
-    gchar *ngram = g_string_chunk_insert(ngramChunk, ngramBuf);
-    ngramScore *score = g_new(ngramScore, 1);
+    if (p == numPrior || prior[p].key != prefix) {
+      g_critical("Missing prior probability for %d-gram in '%s.%d'\n",
+                 ngramLen, file, ngramLen);
+      g_free(prior);
+      g_free(cond);
+      return FALSE;
+    }
 
-    score->value = log(value);
-    score->next  = scoreList;
-    scoreList    = score;
+    scoreZero    -= cond[i].value;
+    cond[i].value = log(cond[i].value) - prior[p].value;
+  }
 
-    g_hash_table_insert(scorePrior, ngram, score);
-  } 
+  scoreZero = log(scoreZero / countZero);
 
-  fclose(fp);
+  if (scoreDenseInit(prior, numPrior, cond, numCond) == FALSE) {
+    scoreSparseInit(&sparsePrior, prior, numPrior, ngramLen-1,
+                    0.0000000000);
+    scoreSparseInit(&sparseCond, cond, numCond, ngramLen, scoreZero);
+  }
+
+  g_free(prior);
+  g_free(cond);
+
+  return TRUE;
+}
+
+
+/**
+ * scoreCompare: Order n-gram entries by key
+ *
+ * @Returns: Negative, zero or positive as for qsort
+ **/
+static int
+scoreCompare (const void *a,
+              const void *b)
+{
+  guint64 x = ((const ngramEntry *) a)->key;
+  guint64 y = ((const ngramEntry *) b)->key;
+
+  return (x > y) - (x < y);
+}
+
+
+/**
+ * scoreReadTable: Read the text table '<file>.<len>' of n-gram
+ *                 probabilities into a list sorted by n-gram
+ *
+ * @file: Base name of score tables
+ * @len: N-gram length
+ * @list: Address where to store the list
+ * @count: Address where to store the number of entries
+ *
+ * @Returns: FALSE if an error occurs
+ **/
+static gboolean
+scoreReadTable (const char  *file,
+                int          len,
+                ngramEntry **list,
+                gsize       *count)
+{
+  gchar *scoreFile = g_strdup_printf("%s.%d", file, len);
+  gchar *format    = g_strdup_printf(" %%%d[a-z] %%lf", len);
+  gchar  ngramBuf[MAXNGRAMLEN+1];
+  gsize  size   = 1024;
+  gboolean sorted = TRUE;
+  gboolean status = TRUE;
+  double value;
+  FILE *fp;
 
-  /* Read in n-gram probabilities */
-  g_string_printf(scoreFile, "%s.%d", file, ngramLen);
-  g_string_printf(format, " %%%d[a-z] %%lf", ngramLen);
-  memset(ngramBuf, NUL, MAXNGRAMLEN+1);
+  *list  = g_new(ngramEntry, size);
+  *count = 0;
 
-  if ((fp = fopen(scoreFile->str, "r")) == NULL) {
-    g_critical("Error opening file '%s' for reading\n", scoreFile->str);
+  if ((fp = fopen(scoreFile, "r")) == NULL) {
+    g_critical("Error opening file '%s' for reading\n", scoreFile);
+    g_free(scoreFile);
+    g_free(format);
     return FALSE;
   }
 
   while (!feof(fp)) {
-    if(fscanf(fp, format->str, ngramBuf, &value) != 2) {
+    if (fscanf(fp, format, ngramBuf, &value) != 2 ||
+        strlen(ngramBuf) != (gsize) len) {
       if (feof(fp)) {
         break;
       } else {
-        g_critical("Error reading score data in '%s'\n", scoreFile->str);
-        return FALSE;
+        g_critical("Error reading score data in '%s'\n", scoreFile);
+        status = FALSE;
+        break;
       }
     }
 
-    gchar *ngram = g_string_chunk_insert(ngramChunk, ngramBuf);
-    ngramScore *score = g_new(ngramScore, 1);
-    ngramBuf[ngramLen-1] = NUL;
-    ngramScore *prior = g_hash_table_lookup(scorePrior, ngramBuf);
+    if (*count == size) {
+      size *= 2;
+      *list = g_renew(ngramEntry, *list, size);
+    }
 
-    g_assert(prior != NULL);
+    ngramEntry *entry = &(*list)[*count];
 
-    score->value = log(value) - prior->value;
-    score->next  = scoreList;
-    scoreList    = score;
+    entry->key   = scoreIndex(ngramBuf, len);
+    entry->value = value;
 
-    g_hash_table_insert(scoreCond, ngram, score);
+    if (*count > 0 && entry->key <= entry[-1].key) {
+      sorted = FALSE;
+    }
 
-    scoreZero -= value;
-    countZero -= 1;
-  } 
+    *count += 1;
+  }
 
   fclose(fp);
 
-  scoreZero = log(scoreZero / countZero);
+  if (sorted == FALSE) {
+    qsort(*list, *count, sizeof(ngramEntry), scoreCompare);
+  }
 
-  g_free(ngramBuf);
-    
-  g_string_free(scoreFile, TRUE);
-  g_string_free(format, TRUE);
-  
-  return TRUE;
+  g_free(scoreFile);
+  g_free(format);
+
+  return status;
 }
 
 
@@ -163,17 +740,26 @@ scoreInit (const char *file)
 gboolean
 scoreDone (void)
 {
-  ngramScore *lp = scoreList;
+  if (scoreMap != NULL) {
+    g_mapped_file_free(scoreMap);
+  } else {
+    g_free(densePrior);
+    g_free(denseCond);
 
-  while (lp != NULL) {
-    ngramScore *np = lp->next;
-    g_free(lp);
-    lp = np;
+    g_free(sparsePrior.bucket);
+    g_free(sparsePrior.keys);
+    g_free(sparsePrior.values);
+    g_free(sparseCond.bucket);
+    g_free(sparseCond.keys);
+    g_free(sparseCond.values);
   }
 
-  g_hash_table_destroy(scorePrior);
-  g_hash_table_destroy(scoreCond);
-  g_string_chunk_free(ngramChunk);
+  g_free(quant16Prior);
+  g_free(quant16Cond);
+  g_free(quant8Prior);
+  g_free(quant8Cond);
+
+  scoreReset();
 
   return TRUE;
 }
@@ -193,29 +779,971 @@ scoreEval (char *str,
 {
   g_assert(len > ngramLen);
 
-  double score = 0.0000000000;
-  char buf[ngramLen+1];
-  
-  memcpy(buf, str, ngramLen-1);
-  buf[ngramLen-1] = NUL;
+  if (quant16Cond != NULL) {
+    guint index = scoreIndex(str, ngramLen-1);
+    gint64 score = quant16Prior[index];
 
-  ngramScore *pn = g_hash_table_lookup(scorePrior, buf);
+    for (int i = ngramLen-1; i < len; i++) {
+      index = index * NUMSYMBOLS + (str[i]-'a');
+      score += quant16Cond[index];
+      index %= densePriorSize;
+    }
 
-  if (pn != NULL) {
-    score += pn->value;
+    return score * quantScale;
   }
 
-  for (int i = ngramLen-1; i < len; i++) {
-    memcpy(buf, &str[i], ngramLen);
-    buf[ngramLen] = NUL;
-    pn = g_hash_table_lookup(scoreCond, buf);
+  if (quant8Cond != NULL) {
+    guint index = scoreIndex(str, ngramLen-1);
+    gint64 score = quant8Prior[index];
 
-    if (pn != NULL) {
-      score += pn->value;
-    } else {
-      score += scoreZero;
+    for (int i = ngramLen-1; i < len; i++) {
+      index = index * NUMSYMBOLS + (str[i]-'a');
+      score += quant8Cond[index];
+      index %= densePriorSize;
     }
+
+    return score * quantScale;
+  }
+
+  return scoreEvalExact(str, len);
+}
+
+
+/**
+ * scoreEvalExact: Evaluate probability for a text string without the
+ *                 quantization selected by --quantize
+ *
+ * @str: Text string to evaluate
+ * @len: Length of text string
+ *
+ * @Returns: Probability of text string
+ **/
+double
+scoreEvalExact (char *str,
+                int   len)
+{
+  g_assert(len > ngramLen);
+
+  double score = 0.0000000000;
+
+  if (denseCond != NULL) {
+    double acc[KERNELLANES] = { 0.0 };
+    guint  index = scoreIndex(str, ngramLen-1);
+    double prior = densePrior[index];
+
+    /* Sum in the same order as the scoring kernels */
+    for (int i = ngramLen-1; i < len; i++) {
+      index = index * NUMSYMBOLS + (str[i]-'a');
+      acc[(i-ngramLen+1) % KERNELLANES] += denseCond[index];
+      index %= densePriorSize;
+    }
+
+    return kernelReduce(acc, prior);
+  }
+
+  guint64 index = scoreIndex(str, ngramLen-1);
+
+  score += scoreSparseFind(&sparsePrior, index);
+
+  for (int i = ngramLen-1; i < len; i++) {
+    index = index * NUMSYMBOLS + (str[i]-'a');
+    score += scoreSparseFind(&sparseCond, index);
+    index %= sparsePrior.space;
   }
 
   return score;
 }
+
+
+/**
+ * scoreNgram: Evaluate probability for a single n-gram. An (n-1)-gram is
+ *             scored with its prior probability, an n-gram with its
+ *             conditional probability.
+ *
+ * @ngram: N-gram character sequence
+ * @len: Length of n-gram (ngramLen-1 or ngramLen)
+ *
+ * @Returns: Probability of n-gram
+ **/
+double
+scoreNgram (char *ngram,
+            int   len)
+{
+  g_assert(len == ngramLen-1 || len == ngramLen);
+
+  return scoreLookup(scoreIndex(ngram, len), len);
+}
+
+
+/**
+ * scoreEvalKey: Evaluate probability for a text of symbol indices (0..25)
+ *               decrypted with a key, without building the decrypted text
+ *
+ * @text: Ciphertext symbols
+ * @len: Length of text
+ * @key: Plaintext symbol for each ciphertext symbol, padded with zeroes
+ *       to KERNELKEYLEN bytes
+ *
+ * @Returns: Probability of decrypted text
+ **/
+double
+scoreEvalKey (const guint8 *text,
+              int           len,
+              const guint8 *key)
+{
+  g_assert(len > ngramLen);
+
+  if (scoreKernel != NULL) {
+    return scoreKernel(&scoreModel, text, len, key);
+  }
+
+  return scoreKeyFunc(text, len, key);
+}
+
+
+/**
+ * scoreEvalBatch: Evaluate probabilities for a text of symbol indices
+ *                 decrypted with each of up to KERNELBATCH keys
+ *
+ * @text: Ciphertext symbols
+ * @len: Length of text
+ * @keys: Keys stored structure-of-arrays, see kernelBatch
+ * @nkeys: Number of keys
+ * @scores: Address where to store the probabilities
+ *
+ * @Returns: Nothing
+ **/
+void
+scoreEvalBatch (const guint8 *text,
+                int           len,
+                const guint8 *keys,
+                int           nkeys,
+                double       *scores)
+{
+  g_assert(len > ngramLen);
+
+  if (scoreKernel != NULL) {
+    kernelBatch(&scoreModel, text, len, keys, nkeys, scores);
+    return;
+  }
+
+  guint8 key[KERNELKEYLEN];
+
+  memset(key, 0, KERNELKEYLEN);
+
+  for (int k = 0; k < nkeys; k++) {
+    for (int c = 0; c < NUMSYMBOLS; c++) {
+      key[c] = keys[c * KERNELBATCH + k];
+    }
+
+    scores[k] = scoreEvalKey(text, len, key);
+  }
+}
+
+
+/**
+ * scoreEvalWin: Sum the probabilities of the windows in two sorted lists
+ *               for a text of symbol indices decrypted with a key,
+ *               counting windows found in both lists once. A window is
+ *               identified by the position of its last symbol; window
+ *               ngramLen-2 is the leading (n-1)-gram.
+ *
+ * @text: Ciphertext symbols
+ * @wx: First sorted list of windows
+ * @nx: Length of @wx
+ * @wy: Second sorted list of windows
+ * @ny: Length of @wy
+ * @key: Plaintext symbol for each ciphertext symbol
+ *
+ * @Returns: Partial probability of decrypted text
+ **/
+double
+scoreEvalWin (const guint8 *text,
+              const int    *wx,
+              int           nx,
+              const int    *wy,
+              int           ny,
+              const guint8 *key)
+{
+  return scoreWinFunc(text, wx, nx, wy, ny, key, -INFINITY);
+}
+
+
+/**
+ * scoreEvalWinBounded: Sum the probabilities of the windows in two sorted
+ *                      lists like scoreEvalWin, but give up as soon as the
+ *                      sum can no longer reach @limit
+ *
+ * @limit: Lowest sum of interest
+ *
+ * @Returns: Partial probability of decrypted text, or an upper bound on
+ *           it that is below @limit
+ **/
+double
+scoreEvalWinBounded (const guint8 *text,
+                     const int    *wx,
+                     int           nx,
+                     const int    *wy,
+                     int           ny,
+                     const guint8 *key,
+                     double        limit)
+{
+  return scoreWinFunc(text, wx, nx, wy, ny, key, limit);
+}
+
+
+/**
+ * scoreEvalHist: Evaluate probability for a text of symbol indices
+ *                decrypted with a key, given the distinct n-grams of the
+ *                text and their counts. With quantized score tables the
+ *                result equals scoreEvalKey bit for bit, see scoreHistExact.
+ *
+ * @text: Ciphertext symbols, for the leading (n-1)-gram
+ * @grams: Distinct ciphertext n-grams, ngramLen symbols each
+ * @counts: Number of occurrences of each n-gram
+ * @num: Number of distinct n-grams
+ * @key: Plaintext symbol for each ciphertext symbol
+ *
+ * @Returns: Probability of decrypted text
+ **/
+double
+scoreEvalHist (const guint8 *text,
+               const guint8 *grams,
+               const int    *counts,
+               int           num,
+               const guint8 *key)
+{
+  return scoreHistFunc(text, grams, counts, num, key);
+}
+
+
+/**
+ * scoreHistExact: Tell whether scoreEvalHist sums exactly, which it does
+ *                 in integer steps over quantized score tables. Over
+ *                 double tables it sums in a different order than a scan
+ *                 of the text, and may differ in the last bits.
+ *
+ * @Returns: TRUE if scoreEvalHist agrees bit for bit with scoreEvalKey
+ **/
+gboolean
+scoreHistExact (void)
+{
+  return (quant16Cond != NULL || quant8Cond != NULL);
+}
+
+
+/**
+ * scoreEvalHistWin: Sum the probabilities of the n-grams in two sorted
+ *                   lists of histogram entries, weighted by their counts,
+ *                   counting entries found in both lists once. Entry -1
+ *                   stands for the leading (n-1)-gram of the text.
+ *
+ * @text: Ciphertext symbols, for the leading (n-1)-gram
+ * @grams: Distinct ciphertext n-grams, ngramLen symbols each
+ * @counts: Number of occurrences of each n-gram
+ * @hx: First sorted list of entries
+ * @nx: Length of @hx
+ * @hy: Second sorted list of entries
+ * @ny: Length of @hy
+ * @key: Plaintext symbol for each ciphertext symbol
+ *
+ * @Returns: Partial probability of decrypted text
+ **/
+double
+scoreEvalHistWin (const guint8 *text,
+                  const guint8 *grams,
+                  const int    *counts,
+                  const int    *hx,
+                  int           nx,
+                  const int    *hy,
+                  int           ny,
+                  const guint8 *key)
+{
+  return scoreHistWinFunc(text, grams, counts, hx, nx, hy, ny, key,
+                          -INFINITY);
+}
+
+
+/**
+ * scoreEvalHistWinBounded: Sum the probabilities of the n-grams in two
+ *                          sorted lists of histogram entries like
+ *                          scoreEvalHistWin, but give up as soon as the
+ *                          sum can no longer reach @limit
+ *
+ * @limit: Lowest sum of interest
+ *
+ * @Returns: Partial probability of decrypted text, or an upper bound on
+ *           it that is below @limit
+ **/
+double
+scoreEvalHistWinBounded (const guint8 *text,
+                         const guint8 *grams,
+                         const int    *counts,
+                         const int    *hx,
+                         int           nx,
+                         const int    *hy,
+                         int           ny,
+                         const guint8 *key,
+                         double        limit)
+{
+  return scoreHistWinFunc(text, grams, counts, hx, nx, hy, ny, key, limit);
+}
+
+
+/**
+ * scoreSpecialize: Choose the scoring loops and kernels compiled for
+ *                  ngramLen. Called once after the options are parsed.
+ *
+ * @Returns: Nothing
+ **/
+void
+scoreSpecialize (void)
+{
+  static const keyFunc keyFuncs[MAXNGRAMLEN+1] = {
+    NULL, NULL, scoreKey2, scoreKey3, scoreKey4,
+    scoreKey5, scoreKey6, scoreKey7, scoreKey8
+  };
+  static const winFunc winFuncs[MAXNGRAMLEN+1] = {
+    NULL, NULL, scoreWin2, scoreWin3, scoreWin4,
+    scoreWin5, scoreWin6, scoreWin7, scoreWin8
+  };
+  static const histFunc histFuncs[MAXNGRAMLEN+1] = {
+    NULL, NULL, scoreHist2, scoreHist3, scoreHist4,
+    scoreHist5, scoreHist6, scoreHist7, scoreHist8
+  };
+  static const histWinFunc histWinFuncs[MAXNGRAMLEN+1] = {
+    NULL, NULL, scoreHistWin2, scoreHistWin3, scoreHistWin4,
+    scoreHistWin5, scoreHistWin6, scoreHistWin7, scoreHistWin8
+  };
+
+  scoreKeyFunc     = scoreKeyAny;
+  scoreWinFunc     = scoreWinAny;
+  scoreHistFunc    = scoreHistAny;
+  scoreHistWinFunc = scoreHistWinAny;
+
+  if (ngramLen >= 0 && ngramLen <= MAXNGRAMLEN &&
+      keyFuncs[ngramLen] != NULL) {
+    scoreKeyFunc     = keyFuncs[ngramLen];
+    scoreWinFunc     = winFuncs[ngramLen];
+    scoreHistFunc    = histFuncs[ngramLen];
+    scoreHistWinFunc = histWinFuncs[ngramLen];
+  }
+
+  kernelSpecialize(ngramLen);
+}
+
+
+/**
+ * scoreLookup: Look up the probability of an n-gram by index in whichever
+ *              score tables are in use
+ *
+ * @index: Base-26 index of n-gram
+ * @len: Length of n-gram (ngramLen-1 or ngramLen)
+ *
+ * @Returns: Probability of n-gram
+ **/
+static double
+scoreLookup (guint64 index,
+             int     len)
+{
+  if (quant16Cond != NULL) {
+    if (len == ngramLen) {
+      return quant16Cond[index] * quantScale;
+    } else {
+      return quant16Prior[index] * quantScale;
+    }
+  }
+
+  if (quant8Cond != NULL) {
+    if (len == ngramLen) {
+      return quant8Cond[index] * quantScale;
+    } else {
+      return quant8Prior[index] * quantScale;
+    }
+  }
+
+  if (denseCond != NULL) {
+    if (len == ngramLen) {
+      return denseCond[index];
+    } else {
+      return densePrior[index];
+    }
+  }
+
+  if (len == ngramLen) {
+    return scoreSparseFind(&sparseCond, index);
+  } else {
+    return scoreSparseFind(&sparsePrior, index);
+  }
+}
+
+
+/**
+ * scoreLookupQuant: Look up the quantized probability of an n-gram by index
+ *                   in the 16-bit or 8-bit score tables
+ *
+ * @index: Base-26 index of n-gram
+ * @len: Length of n-gram (ngramLen-1 or ngramLen)
+ *
+ * @Returns: Probability of n-gram in units of quantScale
+ **/
+static gint64
+scoreLookupQuant (guint64 index,
+                  int     len)
+{
+  if (quant16Cond != NULL) {
+    if (len == ngramLen) {
+      return quant16Cond[index];
+    } else {
+      return quant16Prior[index];
+    }
+  }
+
+  if (len == ngramLen) {
+    return quant8Cond[index];
+  } else {
+    return quant8Prior[index];
+  }
+}
+
+
+/**
+ * scoreMapModel: Map a binary model file read-only and point the score
+ *                tables into it
+ *
+ * @file: Base name of score tables
+ *
+ * @Returns: FALSE if no usable model file exists
+ **/
+static gboolean
+scoreMapModel (const char *file)
+{
+  gchar *modelFile = g_strdup_printf("%s.%d.bin", file, ngramLen);
+  GMappedFile *map = g_mapped_file_new(modelFile, FALSE, NULL);
+
+  if (map == NULL) {
+    g_free(modelFile);
+    return FALSE;
+  }
+
+  const guchar *data = (const guchar *) g_mapped_file_get_contents(map);
+  const guchar *end  = data + g_mapped_file_get_length(map);
+  const guchar *pos  = data + sizeof(modelHeader);
+  modelHeader  *header = (modelHeader *) data;
+
+  guint64  priorSize = pow(NUMSYMBOLS, ngramLen-1);
+  guint64  condSize  = pow(NUMSYMBOLS, ngramLen);
+  gboolean valid;
+
+  valid = ((gsize) (end - data) >= sizeof(modelHeader) &&
+           memcmp(header->magic, MODELMAGIC, sizeof(header->magic)) == 0 &&
+           header->version  == MODELVERSION &&
+           header->ngramLen == (guint32) ngramLen);
+
+  if (valid == TRUE && header->layout == MODELDENSE) {
+    valid = (header->priorSize == priorSize &&
+             header->condSize  == condSize &&
+             (guint64) (end - pos) ==
+             (priorSize+condSize) * sizeof(double));
+
+    if (valid == TRUE) {
+      densePriorSize = priorSize;
+      densePrior     = (double *) pos;
+      denseCond      = densePrior + priorSize;
+    }
+  } else if (valid == TRUE && header->layout == MODELSPARSE) {
+    valid = (scoreMapSparse(&sparsePrior, &pos, end, ngramLen-1) == TRUE &&
+             scoreMapSparse(&sparseCond, &pos, end, ngramLen) == TRUE &&
+             sparsePrior.header.count == header->priorSize &&
+             sparseCond.header.count  == header->condSize &&
+             pos == end);
+  } else {
+    valid = FALSE;
+  }
+
+  if (valid == FALSE) {
+    g_warning("Ignoring unusable model file '%s'\n", modelFile);
+    g_mapped_file_free(map);
+    g_free(modelFile);
+    scoreReset();
+    return FALSE;
+  }
+
+  scoreMap  = map;
+  scoreZero = header->scoreZero;
+
+  g_free(modelFile);
+
+  return TRUE;
+}
+
+
+/**
+ * scoreMapSparse: Point a sparse table into a mapped model file
+ *
+ * @table: Sparse table to set up
+ * @pos: Current position in the model file, advanced past the table
+ * @end: End of the model file
+ * @len: Expected n-gram length
+ *
+ * @Returns: FALSE if the table data is malformed, including bucket
+ *           offsets that decrease or pass the number of keys
+ **/
+static gboolean
+scoreMapSparse (sparseTable   *table,
+                const guchar **pos,
+                const guchar  *end,
+                int            len)
+{
+  if ((gsize) (end - *pos) < sizeof(sparseHeader)) {
+    return FALSE;
+  }
+
+  memcpy(&table->header, *pos, sizeof(sparseHeader));
+
+  if (table->header.len != (guint32) len ||
+      table->header.prefixLen != (guint32) MIN(len, SPARSEPREFIX)) {
+    return FALSE;
+  }
+
+  scoreSparseSize(table, len, table->header.prefixLen);
+
+  guint64 numBuckets = table->space / table->suffixSpace + 1;
+  const guchar *data = *pos + sizeof(sparseHeader);
+
+  if ((gsize) (end - *pos) < scoreSparseBytes(table)) {
+    return FALSE;
+  }
+
+  table->bucket = (guint32 *) data;
+  table->keys   = table->bucket + numBuckets;
+  table->values = (gint16 *) (table->keys + table->header.count);
+
+  /* scoreSparseFind trusts the buckets to stay within the keys */
+  if (table->bucket[0] != 0 ||
+      table->bucket[numBuckets-1] != table->header.count) {
+    return FALSE;
+  }
+
+  for (guint64 i = 1; i < numBuckets; i++) {
+    if (table->bucket[i] < table->bucket[i-1]) {
+      return FALSE;
+    }
+  }
+
+  *pos += scoreSparseBytes(table);
+
+  return TRUE;
+}
+
+
+/**
+ * scoreWriteModel: Write the score tables to a binary model file. The file
+ *                  is written under a temporary name and renamed, so
+ *                  processes that have the old file mapped are not
+ *                  disturbed.
+ *
+ * @file: Base name of score tables
+ *
+ * @Returns: FALSE if an error occurs
+ **/
+static gboolean
+scoreWriteModel (const char *file)
+{
+  modelHeader header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MODELMAGIC, sizeof(header.magic));
+
+  header.version   = MODELVERSION;
+  header.ngramLen  = ngramLen;
+  header.scoreZero = scoreZero;
+
+  if (denseCond != NULL) {
+    header.layout    = MODELDENSE;
+    header.priorSize = densePriorSize;
+    header.condSize  = (guint64) densePriorSize * NUMSYMBOLS;
+  } else {
+    header.layout    = MODELSPARSE;
+    header.priorSize = sparsePrior.header.count;
+    header.condSize  = sparseCond.header.count;
+  }
+
+  gchar *modelFile = g_strdup_printf("%s.%d.bin", file, ngramLen);
+  gchar *tempFile  = g_strdup_printf("%s.tmp", modelFile);
+  gboolean status  = TRUE;
+  FILE *fp;
+
+  if ((fp = fopen(tempFile, "wb")) == NULL) {
+    g_critical("Error opening file '%s' for writing\n", tempFile);
+    status = FALSE;
+  } else {
+    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+      status = FALSE;
+    } else if (header.layout == MODELDENSE) {
+      status = (fwrite(densePrior, sizeof(double), header.priorSize, fp)
+                  == header.priorSize &&
+                fwrite(denseCond, sizeof(double), header.condSize, fp)
+                  == header.condSize);
+    } else {
+      status = (scoreWriteSparse(fp, &sparsePrior) == TRUE &&
+                scoreWriteSparse(fp, &sparseCond) == TRUE);
+    }
+
+    if (status == FALSE) {
+      g_critical("Error writing model data in '%s'\n", tempFile);
+    }
+
+    if (fclose(fp) != 0 || status == FALSE) {
+      remove(tempFile);
+      status = FALSE;
+    } else if (rename(tempFile, modelFile) != 0) {
+      g_critical("Error renaming '%s' to '%s'\n", tempFile, modelFile);
+      remove(tempFile);
+      status = FALSE;
+    } else {
+      printf("Model file '%s' written\n", modelFile);
+    }
+  }
+
+  g_free(modelFile);
+  g_free(tempFile);
+
+  return status;
+}
+
+
+/**
+ * scoreWriteSparse: Write a sparse table to a binary model file
+ *
+ * @Returns: FALSE if an error occurs
+ **/
+static gboolean
+scoreWriteSparse (FILE        *fp,
+                  sparseTable *table)
+{
+  static const guchar padding[8];
+
+  guint64 numBuckets = table->space / table->suffixSpace + 1;
+  guint64 count = table->header.count;
+  gsize   size  = sizeof(sparseHeader) + numBuckets * sizeof(guint32) +
+                  count * (sizeof(guint32) + sizeof(gint16));
+
+  return (fwrite(&table->header, sizeof(sparseHeader), 1, fp) == 1 &&
+          fwrite(table->bucket, sizeof(guint32), numBuckets, fp)
+            == numBuckets &&
+          fwrite(table->keys, sizeof(guint32), count, fp) == count &&
+          fwrite(table->values, sizeof(gint16), count, fp) == count &&
+          fwrite(padding, 1, scoreSparseBytes(table) - size, fp)
+            == scoreSparseBytes(table) - size);
+}
+
+
+/**
+ * scoreIndex: Compute base-26 index of an n-gram
+ *
+ * @ngram: N-gram character sequence
+ * @len: Length of n-gram
+ *
+ * @Returns: Index of n-gram in dense score table
+ **/
+static guint64
+scoreIndex (const char *ngram,
+            int         len)
+{
+  guint64 index = 0;
+
+  for (int i = 0; i < len; i++) {
+    index = index * NUMSYMBOLS + (ngram[i]-'a');
+  }
+
+  return index;
+}
+
+
+/**
+ * scoreDenseInit: Build dense score tables, if the n-gram length is small
+ *                 enough and memory is available
+ *
+ * @Returns: FALSE if dense tables are not used
+ **/
+static gboolean
+scoreDenseInit (ngramEntry *prior,
+                gsize       numPrior,
+                ngramEntry *cond,
+                gsize       numCond)
+{
+  if (ngramLen > MAXDENSELEN) {
+    return FALSE;
+  }
+
+  guint condSize = pow(NUMSYMBOLS, ngramLen);
+
+  densePriorSize = pow(NUMSYMBOLS, ngramLen-1);
+  densePrior     = g_try_new(double, densePriorSize);
+  denseCond      = g_try_new(double, condSize);
+
+  if (densePrior == NULL || denseCond == NULL) {
+    g_free(densePrior);
+    g_free(denseCond);
+    densePrior = NULL;
+    denseCond  = NULL;
+    return FALSE;
+  }
+
+  for (guint i = 0; i < densePriorSize; i++) {
+    densePrior[i] = 0.0000000000;
+  }
+
+  for (guint i = 0; i < condSize; i++) {
+    denseCond[i] = scoreZero;
+  }
+
+  for (gsize i = 0; i < numPrior; i++) {
+    densePrior[prior[i].key] = prior[i].value;
+  }
+
+  for (gsize i = 0; i < numCond; i++) {
+    denseCond[cond[i].key] = cond[i].value;
+  }
+
+  return TRUE;
+}
+
+
+/**
+ * scoreQuantInit: Build quantized copies of the dense score tables and
+ *                 report the largest error this introduces per n-gram
+ *
+ * @Returns: Nothing
+ **/
+static void
+scoreQuantInit (void)
+{
+  if (denseCond == NULL) {
+    g_warning("Sparse score tables are always 16-bit quantized\n");
+    return;
+  }
+
+  guint  condSize = densePriorSize * NUMSYMBOLS;
+  int    quantMax = (quantBits == 8) ? QUANT8MAX : QUANTMAX;
+  double range = 0.0000000000;
+  double error = 0.0000000000;
+
+  for (guint i = 0; i < densePriorSize; i++) {
+    range = MAX(range, fabs(densePrior[i]));
+  }
+
+  for (guint i = 0; i < condSize; i++) {
+    range = MAX(range, fabs(denseCond[i]));
+  }
+
+  quantScale = (range > 0.0) ? range / quantMax : 1.0;
+
+  if (quantBits == 8) {
+    quant8Prior = g_new(gint8, densePriorSize);
+    quant8Cond  = g_new(gint8, condSize);
+  } else {
+    quant16Prior = g_new(gint16, densePriorSize);
+    quant16Cond  = g_new0(gint16, condSize+1);   // Padded for gathers
+  }
+
+  for (guint i = 0; i < densePriorSize + condSize; i++) {
+    double value = (i < densePriorSize) ? densePrior[i]
+                                        : denseCond[i-densePriorSize];
+    long   quant = lround(value / quantScale);
+
+    if (quantBits == 8) {
+      if (i < densePriorSize) {
+        quant8Prior[i] = quant;
+      } else {
+        quant8Cond[i-densePriorSize] = quant;
+      }
+    } else {
+      if (i < densePriorSize) {
+        quant16Prior[i] = quant;
+      } else {
+        quant16Cond[i-densePriorSize] = quant;
+      }
+    }
+
+    error = MAX(error, fabs(quant * quantScale - value));
+  }
+
+  printf("Quantized scores: %d-bit, step %g, max error %g per n-gram\n",
+         quantBits, quantScale, error);
+}
+
+
+/**
+ * scoreBoundInit: Find the highest n-gram score in the tables in use, for
+ *                 bounding the windows a delta scoring loop has left
+ *
+ * @Returns: Nothing
+ **/
+static void
+scoreBoundInit (void)
+{
+  double best = -INFINITY;
+
+  if (denseCond != NULL) {
+    guint condSize = densePriorSize * NUMSYMBOLS;
+
+    for (guint i = 0; i < condSize; i++) {
+      best = MAX(best, scoreLookup(i, ngramLen));
+    }
+  } else {
+    best = sparseCond.header.missing;
+
+    for (guint64 i = 0; i < sparseCond.header.count; i++) {
+      best = MAX(best, sparseCond.values[i] * sparseCond.header.scale);
+    }
+  }
+
+  scoreMaxCond = MIN(best, 0.0);
+}
+
+
+/**
+ * scoreKernelInit: Select a scoring kernel for dense double or 16-bit
+ *                  quantized score tables
+ *
+ * @Returns: Nothing
+ **/
+static void
+scoreKernelInit (void)
+{
+  const char *name;
+
+  if (denseCond == NULL || quant8Cond != NULL) {
+    return;
+  }
+
+  scoreModel.prior     = densePrior;
+  scoreModel.cond      = denseCond;
+  scoreModel.prior16   = quant16Prior;
+  scoreModel.cond16    = quant16Cond;
+  scoreModel.scale     = quantScale;
+  scoreModel.priorSize = densePriorSize;
+  scoreModel.ngramLen  = ngramLen;
+
+  scoreKernel = kernelSelect(&scoreModel, &name);
+
+  printf("Scoring kernel: %s\n", name);
+}
+
+
+/**
+ * scoreSparseInit: Build a sparse score table from a sorted list
+ *
+ * @table: Sparse table to build
+ * @list: N-gram scores sorted by key
+ * @count: Number of entries in @list
+ * @len: N-gram length
+ * @missing: Score of n-grams not in @list
+ *
+ * @Returns: Nothing
+ **/
+static void
+scoreSparseInit (sparseTable *table,
+                 ngramEntry  *list,
+                 gsize        count,
+                 int          len,
+                 double       missing)
+{
+  double range = 0.0000000000;
+
+  for (gsize i = 0; i < count; i++) {
+    range = MAX(range, fabs(list[i].value));
+  }
+
+  table->header.count     = count;
+  table->header.len       = len;
+  table->header.prefixLen = MIN(len, SPARSEPREFIX);
+  table->header.scale     = (range > 0.0) ? range / QUANTMAX : 1.0;
+  table->header.missing   = missing;
+
+  scoreSparseSize(table, len, table->header.prefixLen);
+
+  guint64 numBuckets = table->space / table->suffixSpace + 1;
+
+  table->bucket = g_new0(guint32, numBuckets);
+  table->keys   = g_new(guint32, MAX(count, 1));
+  table->values = g_new(gint16, MAX(count, 1));
+
+  for (gsize i = 0; i < count; i++) {
+    table->bucket[list[i].key / table->suffixSpace + 1] += 1;
+    table->keys[i]   = list[i].key % table->suffixSpace;
+    table->values[i] = lround(list[i].value / table->header.scale);
+  }
+
+  for (guint64 i = 1; i < numBuckets; i++) {
+    table->bucket[i] += table->bucket[i-1];
+  }
+}
+
+
+/**
+ * scoreSparseSize: Compute the index ranges of a sparse table
+ *
+ * @Returns: Nothing
+ **/
+static void
+scoreSparseSize (sparseTable *table,
+                 int          len,
+                 int          prefixLen)
+{
+  table->space       = pow(NUMSYMBOLS, len);
+  table->suffixSpace = pow(NUMSYMBOLS, len - prefixLen);
+}
+
+
+/**
+ * scoreSparseBytes: Compute the size of a sparse table in a model file
+ *
+ * @Returns: Size in bytes, padded to a multiple of eight
+ **/
+static gsize
+scoreSparseBytes (sparseTable *table)
+{
+  guint64 numBuckets = table->space / table->suffixSpace + 1;
+  gsize   size = sizeof(sparseHeader) + numBuckets * sizeof(guint32) +
+                 table->header.count * (sizeof(guint32) + sizeof(gint16));
+
+  return (size + 7) & ~((gsize) 7);
+}
+
+
+/**
+ * scoreSparseFind: Look up an n-gram in a sparse table
+ *
+ * @table: Sparse table to search
+ * @index: Base-26 index of n-gram
+ *
+ * @Returns: Probability of n-gram
+ **/
+static double
+scoreSparseFind (sparseTable *table,
+                 guint64      index)
+{
+  guint32 prefix = index / table->suffixSpace;
+  guint32 suffix = index % table->suffixSpace;
+  guint32 lo = table->bucket[prefix];
+  guint32 hi = table->bucket[prefix+1];
+
+  while (lo < hi) {
+    guint32 mid = lo + (hi - lo) / 2;
+
+    if (table->keys[mid] < suffix) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo < table->bucket[prefix+1] && table->keys[lo] == suffix) {
+    return table->values[lo] * table->header.scale;
+  }
+
+  return table->header.missing;
+}
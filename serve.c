@@ -0,0 +1,783 @@
+/*
+ * serve.c
+ * Copyright (C) Jacob Gajek 2010 <jgajek@gmail.com>
+ *
+ * Alkindus is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Alkindus is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "solve.h"
+
+
+#define SERVEBACKLOG    16      // Connections waiting to be accepted
+#define SERVEMAXTRIALS  10000   // Most trials a request may ask for
+
+
+/*
+ * In serve mode the n-gram model is loaded once and the process answers
+ * requests until its input ends, or forever when listening on a socket.
+ * A request is a JSON object on a line of its own:
+ *
+ *   {"id": 7, "text": "<ciphertext>", "solution": "<plaintext>",
+ *    "seed": 42, "trials": 4, "time": 2.5, "target": -1500}
+ *
+ * of which only "text" is required. The numbers override the options of
+ * the same meaning for this request alone. A number that is malformed or
+ * out of range fails the request: trials must lie in 0..SERVEMAXTRIALS,
+ * time must be finite and not negative, and target must be finite and
+ * not positive. Every request gets one response line,
+ *
+ *   {"id": 7, "key": "...", "plaintext": "...", "score": -1575.836413,
+ *    "trial": 1, "generation": 12, "seconds": 0.214,
+ *    "evaluations": 91733}
+ *
+ * or {"id": 7, "error": "..."}, with the id echoed as it was sent.
+ * Responses come in order of completion, not of the requests.
+ *
+ * Batch mode reads no requests: every cryptogram file of a directory or
+ * list becomes a job whose id is the file name, and the responses are
+ * written as the files are solved.
+ *
+ * Each request is solved by a task of the job pool, which loads its own
+ * solveContext and runs the trials on the trial pool shared by all jobs.
+ * A job task only sleeps while its trials run, so the trial pool stays
+ * as busy as with a single solve, and short cryptograms are not held up
+ * behind long ones.
+ */
+struct s_serveConn {
+  FILE     *in;
+  FILE     *out;
+  GMutex   *lock;               // Serializes response lines
+  poolGroup jobs;               // Requests queued or being solved
+  gboolean  broken;             // Set once a response could not be sent
+};
+
+typedef struct s_serveConn serveConn;
+
+struct s_serveJob {
+  serveConn *conn;
+  gchar     *id;                // Raw JSON value of the id, or NULL
+  gchar     *text;
+  gchar     *solution;
+  gint64     seed;              // Parameters of the solve, 0 if not given
+  int        trials;
+  double     time;
+  double     target;
+};
+
+typedef struct s_serveJob serveJob;
+
+static workPool *trialPool;
+static workPool *jobPool;
+
+static GPtrArray  *serveBatchFiles (const char *source);
+static gint        serveCompare (gconstpointer a, gconstpointer b);
+static void        serveConnRun (serveConn *conn);
+static gpointer    serveConnThread (gpointer data);
+static void        serveSolve   (gpointer data, gpointer udata);
+static void        serveJobFree (serveJob *job);
+static void        serveReply   (serveConn *conn, const gchar *id,
+                                 GString *body);
+static const char *serveParse   (const char *line, serveJob *job);
+static const char *serveValue   (const char *p, GString *out);
+static const char *serveString  (const char *p, GString *out);
+static const char *serveSkip    (const char *p);
+static void        serveQuote   (GString *out, const char *s, int len);
+
+
+/**
+ * serveRun: Answer solve requests read from standard input, or from the
+ *           connections to a UNIX socket
+ *
+ * @socketPath: Path of the socket to listen on, or NULL for stdio
+ * @outFd: File descriptor for the responses to requests read from
+ *         standard input
+ * @jobs: Number of requests solved at once
+ *
+ * @Returns: Exit status of the program
+ **/
+int
+serveRun (const char *socketPath,
+          int         outFd,
+          int         jobs)
+{
+  int status = 0;
+
+  /* The progress line would corrupt the responses */
+  progressInterval = 0;
+
+  /* A client that goes away must not take the server down with it */
+  signal(SIGPIPE, SIG_IGN);
+
+  trialPool = poolNew(maxThreads);
+  jobPool   = poolNew(jobs);
+
+  if (socketPath == NULL) {
+    serveConn conn = { stdin, fdopen(outFd, "w"), g_mutex_new(), { 0 },
+                       FALSE };
+
+    serveConnRun(&conn);
+    fclose(conn.out);
+    g_mutex_free(conn.lock);
+  } else {
+    struct sockaddr_un addr;
+    int                fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+      g_critical("Socket path '%s' is too long\n", socketPath);
+      status = 1;
+    } else if (fd < 0) {
+      g_critical("Error creating socket: %s\n", strerror(errno));
+      status = 1;
+    } else {
+      strcpy(addr.sun_path, socketPath);
+      unlink(socketPath);
+
+      if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+          listen(fd, SERVEBACKLOG) < 0) {
+        g_critical("Error listening on '%s': %s\n", socketPath,
+                   strerror(errno));
+        status = 1;
+      }
+    }
+
+    while (status == 0) {
+      int client = accept(fd, NULL, NULL);
+
+      if (client < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+
+        g_critical("Error accepting connection: %s\n", strerror(errno));
+        status = 1;
+        break;
+      }
+
+      serveConn *conn = g_new0(serveConn, 1);
+
+      conn->in   = fdopen(client, "r");
+      conn->out  = fdopen(dup(client), "w");
+      conn->lock = g_mutex_new();
+
+      g_thread_create(serveConnThread, conn, FALSE, NULL);
+    }
+
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  poolFree(jobPool);
+  poolFree(trialPool);
+
+  return status;
+}
+
+
+/**
+ * serveBatch: Solve every cryptogram file of a directory, or of a list
+ *             with one file name per line, and write a response line for
+ *             each as soon as it is solved. The trials of all files run
+ *             on one pool, so no core idles until the last file is
+ *             being solved.
+ *
+ * @source: Directory or list file
+ * @outFd: File descriptor for the responses
+ * @jobs: Number of files solved at once
+ *
+ * @Returns: Exit status of the program
+ **/
+int
+serveBatch (const char *source,
+            int         outFd,
+            int         jobs)
+{
+  GPtrArray *files = serveBatchFiles(source);
+
+  if (files == NULL) {
+    return 1;
+  }
+
+  progressInterval = 0;
+
+  trialPool = poolNew(maxThreads);
+  jobPool   = poolNew(jobs);
+
+  serveConn conn = { NULL, fdopen(outFd, "w"), g_mutex_new(), { 0 }, FALSE };
+
+  for (guint i = 0; i < files->len; i++) {
+    const char *file = g_ptr_array_index(files, i);
+    serveJob   *job  = g_new0(serveJob, 1);
+    GString    *id   = g_string_new(NULL);
+
+    serveQuote(id, file, strlen(file));
+
+    job->conn = &conn;
+    job->id   = g_string_free(id, FALSE);
+
+    if (g_file_get_contents(file, &job->text, NULL, NULL) == FALSE) {
+      GString *body = g_string_new("\"error\": \"cannot read file\"");
+
+      serveReply(&conn, job->id, body);
+      g_string_free(body, TRUE);
+      serveJobFree(job);
+      continue;
+    }
+
+    poolPush(jobPool, serveSolve, job, NULL, &conn.jobs);
+  }
+
+  poolWait(jobPool, &conn.jobs, -1);
+
+  fclose(conn.out);
+  g_mutex_free(conn.lock);
+
+  poolFree(jobPool);
+  poolFree(trialPool);
+
+  for (guint i = 0; i < files->len; i++) {
+    g_free(g_ptr_array_index(files, i));
+  }
+
+  g_ptr_array_free(files, TRUE);
+
+  return 0;
+}
+
+
+/**
+ * serveBatchFiles: List the cryptogram files of a batch. The files of a
+ *                  directory are taken in order of their names; blank
+ *                  lines of a list file are skipped.
+ *
+ * @source: Directory or list file
+ *
+ * @Returns: Array of file names, or NULL if an error occurs
+ **/
+static GPtrArray *
+serveBatchFiles (const char *source)
+{
+  GPtrArray *files = g_ptr_array_new();
+
+  if (g_file_test(source, G_FILE_TEST_IS_DIR)) {
+    GDir        *dir = g_dir_open(source, 0, NULL);
+    const gchar *name;
+
+    if (dir == NULL) {
+      g_critical("Error opening directory '%s'\n", source);
+      g_ptr_array_free(files, TRUE);
+      return NULL;
+    }
+
+    while ((name = g_dir_read_name(dir)) != NULL) {
+      gchar *file = g_build_filename(source, name, NULL);
+
+      if (g_file_test(file, G_FILE_TEST_IS_REGULAR)) {
+        g_ptr_array_add(files, file);
+      } else {
+        g_free(file);
+      }
+    }
+
+    g_dir_close(dir);
+    g_ptr_array_sort(files, serveCompare);
+  } else {
+    gchar *list;
+
+    if (g_file_get_contents(source, &list, NULL, NULL) == FALSE) {
+      g_critical("Error opening file '%s' for reading\n", source);
+      g_ptr_array_free(files, TRUE);
+      return NULL;
+    }
+
+    gchar **lines = g_strsplit(list, "\n", -1);
+
+    for (int i = 0; lines[i] != NULL; i++) {
+      g_strstrip(lines[i]);
+
+      if (*lines[i] != NUL) {
+        g_ptr_array_add(files, g_strdup(lines[i]));
+      }
+    }
+
+    g_strfreev(lines);
+    g_free(list);
+  }
+
+  return files;
+}
+
+
+/**
+ * serveCompare: Compare two file names for g_ptr_array_sort
+ *
+ * @a: Address of the first name
+ * @b: Address of the second name
+ *
+ * @Returns: Negative, zero or positive as with strcmp
+ **/
+static gint
+serveCompare (gconstpointer a,
+              gconstpointer b)
+{
+  return strcmp(*(const char **) a, *(const char **) b);
+}
+
+
+/**
+ * serveConnRun: Queue a job for every request line of a connection until
+ *               its input ends, then wait for the jobs to finish
+ *
+ * @conn: Connection
+ *
+ * @Returns: Nothing
+ **/
+static void
+serveConnRun (serveConn *conn)
+{
+  char   *line = NULL;
+  size_t  size = 0;
+
+  while (getline(&line, &size, conn->in) >= 0) {
+    if (*serveSkip(line) == NUL) {
+      continue;
+    }
+
+    serveJob   *job   = g_new0(serveJob, 1);
+    const char *error = serveParse(line, job);
+
+    job->conn = conn;
+
+    if (error != NULL) {
+      GString *body = g_string_new("\"error\": ");
+
+      serveQuote(body, error, strlen(error));
+      serveReply(conn, job->id, body);
+      g_string_free(body, TRUE);
+      serveJobFree(job);
+      continue;
+    }
+
+    poolPush(jobPool, serveSolve, job, NULL, &conn->jobs);
+  }
+
+  free(line);
+
+  poolWait(jobPool, &conn->jobs, -1);
+}
+
+
+/**
+ * serveConnThread: Serve a socket connection, then close it
+ *
+ * @data: Connection
+ *
+ * @Returns: NULL
+ **/
+static gpointer
+serveConnThread (gpointer data)
+{
+  serveConn *conn = data;
+
+  serveConnRun(conn);
+
+  fclose(conn->in);
+  fclose(conn->out);
+  g_mutex_free(conn->lock);
+  g_free(conn);
+
+  return NULL;
+}
+
+
+/**
+ * serveSolve: Solve the cryptogram of a request and send the response
+ *
+ * @data: Job
+ * @udata: Unused
+ *
+ * @Returns: Nothing
+ **/
+static void
+serveSolve (gpointer data,
+            gpointer udata)
+{
+  serveJob     *job  = data;
+  solveContext *ctx  = cryptoNew();
+  GString      *body = g_string_new(NULL);
+
+  if (cryptoLoadText(ctx, job->text, job->solution) == FALSE) {
+    g_string_append(body, "\"error\": \"cryptogram is too short\"");
+  } else {
+    if (job->seed != 0) {
+      ctx->seed = job->seed;
+    }
+    if (job->trials > 0) {
+      ctx->numTrials = job->trials;
+    }
+    if (job->time > 0.0) {
+      ctx->timeLimit = job->time;
+    }
+    if (job->target < 0.0) {
+      ctx->targetScore = job->target;
+    }
+
+    cryptoRun(ctx, trialPool);
+    cryptoDecrypt(ctx, ctx->bestKey);
+
+    g_string_append(body, "\"key\": ");
+    serveQuote(body, ctx->bestKey, NUMSYMBOLS);
+    g_string_append(body, ", \"plaintext\": ");
+    serveQuote(body, ctx->decText, ctx->textLen);
+    g_string_append_printf(body, ", \"score\": %f, \"trial\": %d, "
+                           "\"generation\": %d, \"seconds\": %.3f, "
+                           "\"evaluations\": %d",
+                           ctx->bestFit, ctx->bestTrial, ctx->bestGen,
+                           ctx->elapsed, ctx->evalCount);
+  }
+
+  serveReply(job->conn, job->id, body);
+
+  g_string_free(body, TRUE);
+  cryptoFree(ctx);
+  serveJobFree(job);
+}
+
+
+/**
+ * serveJobFree: Free a job
+ *
+ * @job: Job
+ *
+ * @Returns: Nothing
+ **/
+static void
+serveJobFree (serveJob *job)
+{
+  g_free(job->id);
+  g_free(job->text);
+  g_free(job->solution);
+  g_free(job);
+}
+
+
+/**
+ * serveReply: Write a response line. Once a write fails, the client is
+ *             taken to be gone and later responses are dropped.
+ *
+ * @id: Raw JSON value of the request id, or NULL
+ * @body: Members of the response after the id
+ *
+ * @Returns: Nothing
+ **/
+static void
+serveReply (serveConn   *conn,
+            const gchar *id,
+            GString     *body)
+{
+  g_mutex_lock(conn->lock);
+
+  if (conn->broken == FALSE &&
+      (fprintf(conn->out, "{\"id\": %s, %s}\n", (id != NULL) ? id : "null",
+               body->str) < 0 ||
+       fflush(conn->out) != 0)) {
+    conn->broken = TRUE;
+  }
+
+  g_mutex_unlock(conn->lock);
+}
+
+
+/**
+ * serveParse: Parse a request line. Unknown members are ignored, so
+ *             clients may add their own.
+ *
+ * @line: Request line
+ * @job: Job whose id, text, solution and parameters to fill in
+ *
+ * @Returns: NULL, or a description of what is wrong with the request
+ **/
+static const char *
+serveParse (const char *line,
+            serveJob   *job)
+{
+  GString    *name  = g_string_new(NULL);
+  GString    *value = g_string_new(NULL);
+  const char *error = NULL;
+  const char *p     = serveSkip(line);
+  char       *end;
+
+  if (*p++ != '{') {
+    error = "request is not a JSON object";
+  }
+
+  p = serveSkip(p);
+
+  while (error == NULL && *p != '}') {
+    g_string_truncate(name, 0);
+    g_string_truncate(value, 0);
+
+    if ((p = serveString(p, name)) == NULL ||
+        *(p = serveSkip(p)) != ':') {
+      error = "malformed member name";
+      break;
+    }
+
+    const char *start = serveSkip(p+1);
+
+    if ((p = serveValue(start, value)) == NULL) {
+      error = "malformed member value";
+      break;
+    }
+
+    if (strcmp(name->str, "id") == 0) {
+      g_free(job->id);
+      job->id = g_strndup(start, p - start);
+    } else if (strcmp(name->str, "text") == 0 && *start == '"') {
+      g_free(job->text);
+      job->text = g_strdup(value->str);
+    } else if (strcmp(name->str, "solution") == 0 && *start == '"') {
+      g_free(job->solution);
+      job->solution = g_strdup(value->str);
+    } else if (strcmp(name->str, "seed") == 0) {
+      errno     = 0;
+      job->seed = g_ascii_strtoll(start, &end, 10);
+
+      if (end != p || errno == ERANGE) {
+        error = "seed out of range";
+        break;
+      }
+    } else if (strcmp(name->str, "trials") == 0) {
+      gint64 trials = g_ascii_strtoll(start, &end, 10);
+
+      /* Each trial is a pool task, so one request must not queue many */
+      if (end != p || trials < 0 || trials > SERVEMAXTRIALS) {
+        error = "trials out of range";
+        break;
+      }
+
+      job->trials = trials;
+    } else if (strcmp(name->str, "time") == 0) {
+      job->time = g_ascii_strtod(start, &end);
+
+      if (end != p || !isfinite(job->time) || job->time < 0.0) {
+        error = "time out of range";
+        break;
+      }
+    } else if (strcmp(name->str, "target") == 0) {
+      job->target = g_ascii_strtod(start, &end);
+
+      if (end != p || !isfinite(job->target) || job->target > 0.0) {
+        error = "target out of range";
+        break;
+      }
+    }
+
+    p = serveSkip(p);
+
+    if (*p == ',') {
+      p = serveSkip(p+1);
+    } else if (*p != '}') {
+      error = "expected ',' or '}'";
+    }
+  }
+
+  if (error == NULL && job->text == NULL) {
+    error = "request has no text";
+  }
+
+  g_string_free(name, TRUE);
+  g_string_free(value, TRUE);
+
+  return error;
+}
+
+
+/**
+ * serveValue: Find the end of a JSON value. Objects and arrays are only
+ *             skipped, as no member the server reads holds one.
+ *
+ * @p: Start of the value
+ * @out: String to append the characters of a string value to
+ *
+ * @Returns: Position after the value, or NULL if malformed
+ **/
+static const char *
+serveValue (const char *p,
+            GString    *out)
+{
+  const char *start = p;
+  int         depth = 0;
+
+  if (*p == '"') {
+    return serveString(p, out);
+  }
+
+  if (*p != '{' && *p != '[') {
+    /* Numbers, true, false and null */
+    while (g_ascii_isalnum(*p) || *p == '-' || *p == '+' || *p == '.') {
+      p++;
+    }
+
+    return (p > start) ? p : NULL;
+  }
+
+  do {
+    if (*p == '"') {
+      GString *skip = g_string_new(NULL);
+
+      p = serveString(p, skip);
+      g_string_free(skip, TRUE);
+
+      if (p == NULL) {
+        return NULL;
+      }
+      continue;
+    }
+
+    if (*p == NUL) {
+      return NULL;
+    }
+
+    if (*p == '{' || *p == '[') {
+      depth += 1;
+    } else if (*p == '}' || *p == ']') {
+      depth -= 1;
+    }
+
+    p++;
+  } while (depth > 0);
+
+  return p;
+}
+
+
+/**
+ * serveString: Decode a JSON string. Escaped characters beyond ASCII
+ *              decode to '?', which the solver skips like any non-letter.
+ *
+ * @p: Opening quote
+ * @out: String to append the decoded characters to
+ *
+ * @Returns: Position after the closing quote, or NULL if malformed
+ **/
+static const char *
+serveString (const char *p,
+             GString    *out)
+{
+  if (*p++ != '"') {
+    return NULL;
+  }
+
+  for (; *p != '"'; p++) {
+    char c = *p;
+
+    if (c == NUL || c == '\n') {
+      return NULL;
+    }
+
+    if (c == '\\') {
+      switch (*++p) {
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case '"': case '\\': case '/': c = *p; break;
+
+      case 'u': {
+        int code = 0;
+
+        for (int i = 1; i <= 4; i++) {
+          if (!g_ascii_isxdigit(p[i])) {
+            return NULL;
+          }
+          code = code * 16 + g_ascii_xdigit_value(p[i]);
+        }
+
+        c  = (code > 0 && code < 0x80) ? code : '?';
+        p += 4;
+        break;
+      }
+
+      default:
+        return NULL;
+      }
+    }
+
+    g_string_append_c(out, c);
+  }
+
+  return p+1;
+}
+
+
+/**
+ * serveSkip: Skip white space
+ *
+ * @Returns: First character that is not white space
+ **/
+static const char *
+serveSkip (const char *p)
+{
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+    p++;
+  }
+
+  return p;
+}
+
+
+/**
+ * serveQuote: Append a string as a quoted JSON string
+ *
+ * @s: Characters to quote
+ * @len: Number of characters
+ *
+ * @Returns: Nothing
+ **/
+static void
+serveQuote (GString    *out,
+            const char *s,
+            int         len)
+{
+  g_string_append_c(out, '"');
+
+  for (int i = 0; i < len; i++) {
+    if (s[i] == '"' || s[i] == '\\') {
+      g_string_append_c(out, '\\');
+      g_string_append_c(out, s[i]);
+    } else if ((unsigned char) s[i] < 0x20) {
+      g_string_append_printf(out, "\\u%04x", s[i]);
+    } else {
+      g_string_append_c(out, s[i]);
+    }
+  }
+
+  g_string_append_c(out, '"');
+}
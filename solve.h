@@ -26,13 +26,51 @@
 #define NUMSYMBOLS  26
 #define MAXNGRAMLEN 8
 #define MAXVOWELS   7
+#define MAXDENSELEN 5     // Longest n-gram length stored in dense tables
 
-extern GMutex *updateBestMutex;
+#define SOLVEGENETIC    0   // Solver engines
+#define SOLVEANNEAL     1
 
-extern char bestKey[];
-extern double bestFit;
-extern int bestTrial;
-extern int bestGen;
+#define SCHEDGEOMETRIC  0   // Annealing temperature schedules
+#define SCHEDLINEAR     1
+#define SCHEDLUNDY      2
+
+#define TOPORING        0   // Island model migration topologies
+#define TOPOFULL        1
+#define MAXMIGRANTS     16  // Most keys sent per migration
+
+#define INITVOWEL       0   // Seed keys from the identified vowels
+#define INITFREQ        1   // Seed keys by matching letter frequencies
+
+#define MAXPOPSIZE      65535   // Most keys whose rank weights sum to an int
+
+#define KERNELLANES   8     // Partial sums kept by scoring kernels
+#define KERNELKEYLEN  32    // Size of a key passed to scoring kernels
+#define KERNELBATCH   64    // Most keys scored in one pass over the text
+
+extern gint64 randSeed;
+
+extern int solverType;
+extern int annealSchedule;
+extern int annealSteps;
+extern double startTemp;
+
+extern int progressInterval;
+
+extern int migrateInterval;
+extern int numMigrants;
+extern int islandTopology;
+
+extern int stagnantGens;
+extern int minDiversity;
+extern gboolean restartTrials;
+extern double timeLimit;
+extern double targetScore;
+extern int raceEta;
+extern int initMode;
+extern int steadyOffspring;
+
+extern double unigramProb[];
 
 extern int ngramLen;
 extern int numTrials;
@@ -40,34 +78,211 @@ extern int maxThreads;
 extern int maxGens;
 extern int popSize;
 extern int muteRate;
-extern int freq[];
+extern int quantBits;
+extern gboolean histScoring;
+
+
+/* Dense score tables as seen by the scoring kernels */
+struct s_kernelModel {
+  const double *prior;      // Prior log-probabilities
+  const double *cond;       // Conditional log-probabilities
+  const gint16 *prior16;    // 16-bit quantized tables, or NULL
+  const gint16 *cond16;
+  double        scale;      // Log-probability of one quantization step
+  guint         priorSize;  // Number of (n-1)-grams, 26^(n-1)
+  int           ngramLen;
+};
+
+typedef struct s_kernelModel kernelModel;
+
+/* State of a xoshiro256** random number generator */
+struct s_rngState {
+  guint64 s[4];
+};
 
-extern int numLeft;
+typedef struct s_rngState rngState;
 
-extern gboolean isVowel[];
-extern char vowels[];
-extern int numVowels;
+/* Work-stealing thread pool, and a group of tasks to wait for */
+typedef struct s_workPool workPool;
 
-extern char *encText;
-extern char *decText;
-extern char *solText;
-extern int textLen;
+struct s_poolGroup {
+  volatile gint pending;
+};
 
+typedef struct s_poolGroup poolGroup;
 
+/* Resumable state of a GA trial */
+typedef struct s_genTrial genTrial;
+
+/* Fixed-size cache of key scores, owned by one trial */
+typedef struct s_fitMemo fitMemo;
+
+/*
+ * Everything that belongs to the solve of one cryptogram: the text and
+ * the indexes built from it, the vowel analysis, the parameters that may
+ * differ between solves, and the result. The score model and the shape of
+ * the trials (population, generations, threads) are shared by all solves,
+ * so several cryptograms can be solved at once in one process.
+ */
+struct s_solveContext {
+  /* Parameters, copied from the options by cryptoNew */
+  gint64    seed;               // Seed of the trial random number streams
+  int       numTrials;
+  double    timeLimit;          // Seconds before trials are cancelled
+  double    targetScore;        // Score that ends the solve, if below 0
+
+  /* Ciphertext and its analysis, set up by cryptoLoad */
+  char     *encText;            // Ciphertext
+  guint8   *encSym;             // Ciphertext as symbol indices 0..25
+  guint8   *encSymBuf;          // Allocation holding the aligned encSym
+  char     *decText;            // Plaintext
+  char     *solText;            // Text of correct solution (if given)
+  int       textLen;            // Length of ciphertext/plaintext
+  int       freq[NUMSYMBOLS];   // Count of each ciphertext letter
+
+  gboolean  isVowel[NUMSYMBOLS];
+  char      vowels[MAXVOWELS];
+  int       numVowels;
+
+  /* Scoring indexes, see crypto.c */
+  int      *swapWin[NUMSYMBOLS];
+  int       swapLen[NUMSYMBOLS];
+  guint8   *histGram;
+  int      *histCount;
+  int       numHist;
+  gboolean  useHist;
+  int      *histWin[NUMSYMBOLS];
+  int       histWinLen[NUMSYMBOLS];
+
+  /* State of a running solve */
+  gpointer      bestRec;        // Overall best key, see cryptoPublish
+  GTimer       *timer;
+  poolGroup     group;          // Trials queued or running
+  volatile gint cancel;         // Set when all trials should stop early
+  gpointer     *mailbox;        // Island model mailboxes
+  volatile gint *islandBusy;    // Set for islands claimed by a trial
+  int           numIslands;
+
+  /* Result of the solve */
+  char          bestKey[NUMSYMBOLS+1];
+  double        bestFit;
+  int           bestTrial;
+  int           bestGen;
+  double        elapsed;        // Seconds taken by the solve
+  volatile gint publishOffers;  // Keys offered to cryptoPublish
+  volatile gint publishUpdates; // Offers that replaced the overall best
+  volatile gint memoHits;       // Fitness cache lookups answered
+  volatile gint memoMisses;     // Fitness cache lookups not answered
+  volatile gint evalCount;      // Keys scored in full or by a swap
+};
+
+typedef struct s_solveContext solveContext;
+
+typedef double (*kernelFunc) (const kernelModel *model,
+                              const guint8      *text,
+                              int                len,
+                              const guint8      *key);
+
+
+void     scoreSpecialize (void);
 gboolean scoreInit  (const char *file);
+gboolean scoreConvert (const char *file);
+gboolean scoreUnigram (const char *file, double *prob);
 gboolean scoreDone  (void);
 double   scoreEval  (char *str, int len);
+double   scoreEvalExact (char *str, int len);
+double   scoreNgram (char *ngram, int len);
+double   scoreEvalKey (const guint8 *text, int len, const guint8 *key);
+void     scoreEvalBatch (const guint8 *text, int len,
+                         const guint8 *keys, int nkeys, double *scores);
+double   scoreEvalWin (const guint8 *text, const int *wx, int nx,
+                       const int *wy, int ny, const guint8 *key);
+double   scoreEvalHist (const guint8 *text, const guint8 *grams,
+                        const int *counts, int num, const guint8 *key);
+gboolean scoreHistExact (void);
+double   scoreEvalHistWin (const guint8 *text, const guint8 *grams,
+                           const int *counts, const int *hx, int nx,
+                           const int *hy, int ny, const guint8 *key);
+double   scoreEvalWinBounded (const guint8 *text, const int *wx, int nx,
+                              const int *wy, int ny, const guint8 *key,
+                              double limit);
+double   scoreEvalHistWinBounded (const guint8 *text, const guint8 *grams,
+                                  const int *counts, const int *hx, int nx,
+                                  const int *hy, int ny, const guint8 *key,
+                                  double limit);
 
-gboolean cryptoLoad (const char *file, const char *solution);
-gboolean cryptoFree (void);
+void       kernelSpecialize (int n);
+kernelFunc kernelSelect (const kernelModel *model, const char **name);
+double     kernelReduce (const double *acc, double prior);
+void       kernelBatch  (const kernelModel *model, const guint8 *text,
+                         int len, const guint8 *keys, int nkeys,
+                         double *scores);
 
-double  cryptoEval  (char *key);
-void    cryptoSolve (void);
-void	  cryptoPrint (char *key);
+solveContext *cryptoNew (void);
+gboolean cryptoLoad (solveContext *ctx, const char *file,
+                     const char *solution);
+gboolean cryptoLoadText (solveContext *ctx, const char *text,
+                         const char *solution);
+gboolean cryptoFree (solveContext *ctx);
+
+double  cryptoEval  (solveContext *ctx, char *key);
+double  cryptoEvalSwap (solveContext *ctx, char *key, double oldScore,
+                        int x, int y);
+double  cryptoEvalSwapBounded (solveContext *ctx, char *key,
+                               double oldScore, int x, int y,
+                               double threshold);
+void    cryptoEvalBatch (solveContext *ctx, char **keys, int nkeys,
+                         double *scores);
+void    cryptoBench (solveContext *ctx);
+void    cryptoSolve (solveContext *ctx);
+void    cryptoRun   (solveContext *ctx, workPool *pool);
+void	  cryptoPrint (solveContext *ctx, char *key);
+void    cryptoDecrypt (solveContext *ctx, const char *key);
+void    cryptoPublish (solveContext *ctx, const char *key, double fit,
+                       int trial, int gen);
+
+void    rngInit (rngState *rng, guint64 seed, guint64 stream);
+guint64 rngNext (rngState *rng);
+int     rngInt  (rngState *rng, int n);
+double  rngDouble (rngState *rng);
 
 void	genSolve	    (gpointer trial, gpointer udata);
 
-void  vowIdentify   (void);
+genTrial *genTrialNew  (solveContext *ctx, int trial);
+void      genTrialRun  (genTrial *t, int gens);
+double    genTrialFit  (genTrial *t);
+void      genTrialFree (genTrial *t);
+
+void  annealSolve   (gpointer trial, gpointer udata);
+
+workPool *poolNew     (int threads);
+void      poolFree    (workPool *pool);
+void      poolPush    (workPool *pool, GFunc func, gpointer data,
+                       gpointer udata, poolGroup *group);
+void      poolJoin    (workPool *pool, poolGroup *group);
+gboolean  poolWait    (workPool *pool, poolGroup *group, gint64 timeout);
+void      poolStatus  (workPool *pool, int *queued, int *running);
+workPool *poolCurrent (void);
+
+fitMemo *memoNew    (void);
+void      memoFree   (fitMemo *memo);
+gboolean  memoLookup (fitMemo *memo, const char *key, double *fit);
+void      memoInsert (fitMemo *memo, const char *key, double fit);
+void      memoStats  (fitMemo *memo, int *hits, int *misses);
+
+void  islandInit    (solveContext *ctx, int islands);
+void  islandFree    (solveContext *ctx);
+int   islandClaim   (solveContext *ctx);
+void  islandRelease (solveContext *ctx, int island);
+void  islandSend    (solveContext *ctx, int island, char **popKey,
+                     double *popFit);
+int   islandReceive (solveContext *ctx, int island, char **popKey,
+                     double *popFit);
+
+void  vowIdentify   (solveContext *ctx);
+
+int   serveRun      (const char *socketPath, int outFd, int jobs);
+int   serveBatch    (const char *source, int outFd, int jobs);
 
 
 
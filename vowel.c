@@ -22,19 +22,21 @@
 
 #include "solve.h"
 
-gboolean isVowel[NUMSYMBOLS];
-char vowels[MAXVOWELS];
-int  numVowels = 0;
 
 /**
  * vowIdentify: Identify which ciphertext characters most likely represent
  *              vowels. Uses Sukhotin's algorithm.
  *
+ * @ctx: Solve of a loaded cryptogram
+ *
  * @Returns: Nothing
  **/
 void
-vowIdentify (void)
+vowIdentify (solveContext *ctx)
 {
+  gboolean *isVowel = ctx->isVowel;
+  char     *encText = ctx->encText;
+
 	int cmat[NUMSYMBOLS][NUMSYMBOLS];
 	int csum[NUMSYMBOLS];
 
@@ -46,7 +48,7 @@ vowIdentify (void)
   }
 
   /* Initialize adjacency matrix */
-	for (int i = 1; i < textLen; i++) {
+	for (int i = 1; i < ctx->textLen; i++) {
 		cmat[encText[i]-'a'][encText[i-1]-'a'] += 1;
 		cmat[encText[i-1]-'a'][encText[i]-'a'] += 1;
 	}
@@ -70,10 +72,10 @@ vowIdentify (void)
       }
 		}
 
-		if (maxSum > 0 && numVowels < MAXVOWELS) {
+		if (maxSum > 0 && ctx->numVowels < MAXVOWELS) {
 			isVowel[index] = TRUE;
-			vowels[numVowels] = 'a' + index;
-			numVowels += 1;
+			ctx->vowels[ctx->numVowels] = 'a' + index;
+			ctx->numVowels += 1;
 		} else {
 			break;
 		}
@@ -84,12 +86,4 @@ vowIdentify (void)
 			}
 		}
 	}
-
-  printf("PROBABLE VOWELS: ");
-
-  for (int i = 0; i < numVowels; i++) {
-    printf("%c ", vowels[i]);
-  }
-
-  printf("\n\n");
 }